@@ -14,6 +14,12 @@
 // give each thread/task/process its own stack with size
 // stacks are allocated here statically, because malloc() is not supported
 OS_STK InitTaskStk     [STACK_SIZE];
+#if defined(MALLOC_TRACE) && MALLOC_TRACE
+OS_STK TraceTaskStk    [STACK_SIZE];
+#endif
+#if defined(STACK_PROFILE) && STACK_PROFILE
+OS_STK StackTaskStk    [STACK_SIZE];
+#endif
 
 // put some debug-output to uart
 void DisplayOSData(void)
@@ -29,6 +35,79 @@ void DisplayOSData(void)
     UART_put(" MHz\n\r");
 }
 
+#if defined(MALLOC_DEBUG) && MALLOC_DEBUG
+// put heap errors found by free/realloc to uart
+void MallocError(int error, void *mem)
+{
+    UART_put("\n\rmalloc: ");
+    UART_put(error == MALLOC_BAD_POINTER ? "pointer not in heap" :
+             error == MALLOC_BAD_BLOCK ? "bad block or double free" : "overrun");
+    UART_put(" at ");
+    UART_putint((int)mem);
+    UART_put("\n\r");
+}
+#endif
+
+// put the heap usage next to the cpu usage to uart
+void DisplayHeapData(void)
+{
+    heap_stats stats;
+    heap_walker walker;
+    
+    malloc_stats(&stats);
+    UART_put("\n\r cpu: ");
+    UART_putint(OSCPUUsage);
+    UART_put("% heap: ");
+    UART_putint(stats.heap_size);
+    UART_put(" (peak ");
+    UART_putint(stats.heap_peak);
+    UART_put(", room ");
+    UART_putint(stats.heap_room);
+    UART_put(") used: ");
+    UART_putint(stats.used_bytes);
+    UART_put(" free: ");
+    UART_putint(stats.free_bytes);
+    UART_put(" in ");
+    UART_putint(stats.free_blocks);
+    UART_put(" blocks, failed: ");
+    UART_putint(stats.failed);
+    
+    // walk the heap a few blocks at a time, so other tasks keep running
+    heap_walk_start(&walker);
+    while(heap_walk_steps(&walker, 16))
+        OSTimeDly(1);
+    UART_put("\n\r largest free block: ");
+    UART_putint(walker.largest_free);
+    UART_put(" fragmentation: ");
+    UART_putint(walker.fragmentation);
+    UART_put("%\n\r");
+}
+
+#if defined(WCET_SITES) && WCET_SITES
+// put the longest call of malloc and co. from each place in the code to uart,
+// in ticks of timer 1. Look the site up in the map file
+void DisplayWcetData(void)
+{
+    wcet_site sites[WCET_SITES];
+    unsigned int count;
+    unsigned int i;
+    
+    count = malloc_wcet(sites, WCET_SITES);
+    for(i = 0; i < count; i++)
+    {
+        UART_put("\n\r site: ");
+        UART_putint((int)sites[i].site);
+        UART_put(" op: ");
+        UART_putint(sites[i].op);
+        UART_put(" calls: ");
+        UART_putint(sites[i].calls);
+        UART_put(" worst: ");
+        UART_putint(sites[i].worst);
+    }
+    UART_put("\n\r");
+}
+#endif
+
 //////////////////////////////////////////////////////////////////////////////
 // func: InitTask
 // args: void *pdata, needed by os
@@ -42,7 +121,6 @@ void DisplayOSData(void)
 void InitTask(void *pdata)
 {
     int i;
-    OS_STK * bla;
 
     /* Start timer; after this, uC/OS-II is fully running */
     timer_init();
@@ -54,15 +132,22 @@ void InitTask(void *pdata)
     
     DisplayOSData(); // output to uart of some data
     
+#if defined(MALLOC_TRACE) && MALLOC_TRACE
+    /* Send the allocation trace over the uart, see trace.c */
+    OSTaskCreate(TraceTask, NULL, &TraceTaskStk[STACK_SIZE-1], TRACETASK_PRIORITY);
+#endif
+    
+#if defined(STACK_PROFILE) && STACK_PROFILE
+    /* Shrink the stacks of the dynamic tasks to what they use, see stack.c */
+    OSTaskCreate(StackTask, NULL, &StackTaskStk[STACK_SIZE-1], STACKTASK_PRIORITY);
+#endif
+    
     for(i=9;i</*29*/49;i++)
     {
-        bla = (OS_STK *)malloc(STACK_SIZE * sizeof(OS_STK));
-        if(bla == NULL)
+        if(StackCreate(MutexTask0, NULL, i, STACK_SIZE) != OS_NO_ERR)
         {
             break;
         }  
-        OSTaskCreateExt(MutexTask0, NULL, &bla[STACK_SIZE-1],i,
-                    i, bla, STACK_SIZE, NULL, OS_TASK_OPT_STK_CHK);
     }              
 
 
@@ -80,6 +165,10 @@ void InitTask(void *pdata)
     UART_put("\n\r maximum number of tasks: ");
     UART_putint(OS_MAX_TASKS);
     UART_put("\n\r");
+    DisplayHeapData();
+#if defined(WCET_SITES) && WCET_SITES
+    DisplayWcetData();
+#endif
 
 
     
@@ -87,7 +176,8 @@ void InitTask(void *pdata)
     LCD_clear(); 
 	LCD_cursor_home();
 
-    /* This task is no longer needed; delete it */
+    /* This task is no longer needed; give back its magazine, and delete it */
+    flush_magazine();
    	OSTaskDel(OS_PRIO_SELF);
 }
 
@@ -96,7 +186,13 @@ int main (void)
   This is the main-function from the C-code. It's called from crt0.s after the needed low-level stuff is done. It's supposed to be an endless loop.
 */
 {
+#if defined(WCET_SITES) && WCET_SITES
+    T1TCR = 1; // let timer 1 count, malloc.c times its calls with it
+#endif
     init_malloc();
+#if defined(MALLOC_DEBUG) && MALLOC_DEBUG
+    set_malloc_hook(MallocError);
+#endif
     /* The first thing to do when starting uC/OS-II; initialise it */
     OSInit();
     /* Initialize hardware */
@@ -9,14 +9,32 @@
 
  
 #define INITTASK_PRIORITY        5
+#define STACKTASK_PRIORITY       60
+#define TRACETASK_PRIORITY       61
 
 #define WAIT_FOREVER             0
 #define STACK_SIZE               500
 #define LOOP_DELAY               20   
 
+// stack.c, with STACK_PROFILE: bytes kept on top of the high-water mark when
+// a stack is shrunk, ticks between checks, and how many checks the mark must
+// stay the same
+#define STACK_HEADROOM           64
+#define STACK_PERIOD             OS_TICKS_PER_SEC
+#define STACK_STABLE             10
+// "S: {prio, bytes}," lines that StackTask put on the uart during an earlier
+// boot, these tasks start with a stack of that size plus STACK_HEADROOM
+#define STACK_SIZES
+
 
 // function prototypes of threads/tasks/processes to prevent compiler warnings
 extern void DisplayOSData (void);
+extern void DisplayHeapData (void);
+extern void DisplayWcetData (void);
+extern void MallocError   (int error, void *mem);
 extern void InitTask      (void *pdata);
 extern void MutexTask0    (void *pdata);
+extern void TraceTask     (void *pdata);
+extern void StackTask     (void *pdata);
+extern INT8U StackCreate  (void (*task)(void *pd), void *pdata, INT8U prio, INT32U size);
 
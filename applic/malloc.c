@@ -18,7 +18,10 @@
  * This malloc function tries to cope with memory effinciently, without re-
  * organising any used blocks, and with returning aligned blocks of memory.
  * It also allows for the stack/heap to expand/shrink dynamically.
- * It uses a first-fit strategy, and tries to keep any excess memory available.
+ * It uses a first-fit strategy(or next/best fit, see MALLOC_FIT), and tries
+ * to keep any excess memory available.
+ * Free blocks carry boundary tags, so merging them takes constant time.
+ * (or a TLSF engine, with constant time malloc/free, see MALLOC_TLSF)
  * It has a minimum size for blocks, so any size under this will be resized to
  * this.
  *
@@ -42,10 +45,12 @@
  * head to tail). At default it is set to 8 bytes, which is the size of the 
  * structure that malloc uses to keep track of a block. Any wrong alignment 
  * usually resuls in data abort exeptions, and corrupt block information for
- * the following calls.
+ * the following calls. Must be a power of two.
  */
  
+#ifndef BLOCK_ALIGN
 #define BLOCK_ALIGN       8
+#endif
 
 /* STACK_MARGIN
  *
@@ -53,288 +58,3966 @@
  * as the stack sometimes uses some space for stack overflow checking.
  */
 
+#ifndef STACK_MARGIN
 #define STACK_MARGIN      16
+#endif
+
+/* TRIM_THRESHOLD, TOP_PAD
+ *
+ * the heap claims memory from the stack side up to a top, which is at least
+ * heap_end. When the heap grows past it, it claims TOP_PAD bytes more than
+ * it needs. When it shrinks, the top is only lowered once more than
+ * TRIM_THRESHOLD bytes are left above heap_end, and then to TOP_PAD bytes
+ * above it. Until then, update_heap_size() will not give it to the stack,
+ * but malloc_trim() will. 0 and 0 give back all memory right away. TOP_PAD
+ * may not be larger than TRIM_THRESHOLD.
+ */
+
+#ifndef TRIM_THRESHOLD
+#define TRIM_THRESHOLD    0
+#endif
+#ifndef TOP_PAD
+#define TOP_PAD           0
+#endif
+
+/* MALLOC_FIT
+ *
+ * selects how the first-fit engine picks a free block, until it is changed
+ * with malloc_set_policy(). FIT_FIRST takes the first block on the free list
+ * that fits. FIT_NEXT goes on searching where the last search ended, which
+ * spreads the blocks over the heap. FIT_BEST takes the smallest block that
+ * fits, which keeps the large ones intact, but searches the whole list unless
+ * it finds one that fits without a rest. The TLSF engine allways takes a good
+ * fit, and ignores this. The FIT_ names are in malloc.h.
+ */
+
+#ifndef MALLOC_FIT
+#define MALLOC_FIT        FIT_FIRST
+#endif
+
+/* SPLIT_THRESHOLD
+ *
+ * a free block that is larger than asked is split, and the rest kept as a
+ * free block, if the rest holds at least this many bytes. Smaller rests stay
+ * in the block, and are wasted until it is freed again. 0 splits off every
+ * rest that can be a block of its own. Must be a multiple of BLOCK_ALIGN.
+ */
+
+#ifndef SPLIT_THRESHOLD
+#define SPLIT_THRESHOLD   0
+#endif
+
+/* COMPACT_HEADER
+ *
+ * set to 1 to give used blocks a header of one word, the size and flags,
+ * instead of two. The free list link that is the second word is only used
+ * while a block is free, so it moves into the block itself. Every block then
+ * costs 4 bytes less on average, the block header is no longer aligned, but
+ * the memory malloc returns still is. Can not be combined with MALLOC_DEBUG,
+ * which keeps its magic word in the link of used blocks.
+ */
+
+#ifndef COMPACT_HEADER
+#define COMPACT_HEADER    0
+#endif
+
+/* MALLOC_STATS
+ *
+ * set to 0 to leave out the counters of malloc_stats(). It then only fills
+ * in heap_size, heap_peak and heap_room.
+ */
+
+#ifndef MALLOC_STATS
+#define MALLOC_STATS      1
+#endif
+
+/* QUICK_LIST_MAX
+ *
+ * blocks of up to this many bytes (after rounding to BLOCK_ALIGN) are kept
+ * on per-size quick lists when they are freed. free() pushes them on the list
+ * for their size without merging, and malloc() pops them again, both without
+ * walking the free list. The lists are only fed back into the free list (and
+ * merged) when malloc runs out of memory. Must be a multiple of BLOCK_ALIGN,
+ * set to 0 to disable the quick lists.
+ */
+
+#ifndef QUICK_LIST_MAX
+#define QUICK_LIST_MAX    32
+#endif
+
+/* SLAB_MAX, SLAB_BYTES, SLAB_COUNT
+ *
+ * objects of up to SLAB_MAX bytes (after rounding to BLOCK_ALIGN) are cut
+ * from slabs, heap blocks of SLAB_BYTES that each hold objects of one size,
+ * without a header. A one word bitmap in front of them tells which are free.
+ * A slab starts on a multiple of SLAB_BYTES, so free() finds it from the
+ * address of the object. An empty slab goes back to the heap right away, so
+ * the heap can still shrink. At most SLAB_COUNT slabs exist at a time, after
+ * that small objects are taken from the heap as usual. SLAB_MAX must be a
+ * multiple of BLOCK_ALIGN, SLAB_BYTES a power of two, set SLAB_MAX to 0 to
+ * disable the slabs. Can not be combined with MALLOC_DEBUG, as the objects
+ * have no header to check.
+ */
+
+#ifndef SLAB_MAX
+#define SLAB_MAX          0
+#endif
+#ifndef SLAB_BYTES
+#define SLAB_BYTES        256
+#endif
+#ifndef SLAB_COUNT
+#define SLAB_COUNT        16
+#endif
+
+/* MALLOC_TLSF
+ *
+ * selects the allocation engine. 0 uses the first-fit free list, 1 uses a
+ * TLSF(two-level segregated fit) engine, which finds and merges blocks in
+ * constant time, no matter how many free blocks there are. This gives a
+ * bounded time for every malloc/free call, at the cost of some RAM for its
+ * lookup tables. The heap still grows and shrinks at heap_end with _sbrk.
+ * The quick lists are not used with TLSF, as it is allready O(1).
+ */
+
+#ifndef MALLOC_TLSF
+#define MALLOC_TLSF       0
+#endif
+
+/* MALLOC_BOUNDED, RESERVE_MIN, RESERVE_CLASSES, RESERVE_COUNT
+ *
+ * set MALLOC_BOUNDED to the most free blocks one search of the first-fit
+ * engine may look at, so malloc takes bounded time however long the free list
+ * gets. A malloc that runs out of memory flushes at most that many blocks from
+ * the quick lists too, so it takes at most three times MALLOC_BOUNDED steps,
+ * and memalign four times, see worst_call of malloc_fit_stats(). free is
+ * bounded allready. A malloc that fails takes a block from the reserve:
+ * init_malloc sets RESERVE_COUNT blocks apart of RESERVE_MIN bytes, and of
+ * each double of it, RESERVE_CLASSES sizes in all. They go back to the
+ * reserve when freed. If the reserve has none, the call returns NULL, and
+ * malloc_error() tells a search that gave up from a full heap. With
+ * MALLOC_ISR, a call gives back at most MALLOC_BOUNDED of the blocks freed by
+ * interrupts as well, the rest waits for the next call, so call
+ * flush_isr_frees() often, it gives them all back. 0 leaves the bound out.
+ * TLSF needs none.
+ */
+
+#ifndef MALLOC_BOUNDED
+#define MALLOC_BOUNDED    0
+#endif
+#ifndef RESERVE_MIN
+#define RESERVE_MIN       16
+#endif
+#ifndef RESERVE_CLASSES
+#define RESERVE_CLASSES   4
+#endif
+#ifndef RESERVE_COUNT
+#define RESERVE_COUNT     2
+#endif
+
+/* CALLOC_ZERO_HEAP, CLEAN_MARGIN
+ *
+ * set CALLOC_ZERO_HEAP to 1 to have init_malloc zero all free RAM above the
+ * heap once. calloc() then knows that blocks the heap grows into for the first
+ * time are allready zero, and only has to clear recycled blocks. Costs one
+ * word fill of the free RAM at startup. The CLEAN_MARGIN bytes under the
+ * stack are left out: the caller of init_malloc goes on using its stack
+ * (OSInit, OSTaskCreate and OSStart in main.c), and may write there. Make it
+ * at least as deep as those calls go.
+ */
+
+#ifndef CALLOC_ZERO_HEAP
+#define CALLOC_ZERO_HEAP  1
+#endif
+#ifndef CLEAN_MARGIN
+#define CLEAN_MARGIN      1024
+#endif
+
+/* MALLOC_UCOS
+ *
+ * set to 1 when malloc/free are called from more than one uC/OS-II task. The
+ * heap is then locked with OSSchedLock(), which keeps interrupts enabled, so
+ * malloc/free must not be called from an interrupt. Every task priority also
+ * gets a magazine, a few recently freed blocks that only this task uses, so
+ * most small malloc/free calls do not need the lock at all.
+ */
+
+#ifndef MALLOC_UCOS
+#define MALLOC_UCOS       0
+#endif
+
+/* MAGAZINE_SIZE, MAGAZINE_MAX
+ *
+ * the number of blocks a task keeps in its magazine, and the largest block
+ * (in bytes, after rounding to BLOCK_ALIGN) that is kept. Larger blocks always
+ * go back to the heap. When a magazine is full, it is emptied into the heap
+ * all at once, so the lock is taken once for MAGAZINE_SIZE blocks.
+ */
+
+#ifndef MAGAZINE_SIZE
+#define MAGAZINE_SIZE     4
+#endif
+#ifndef MAGAZINE_MAX
+#define MAGAZINE_MAX      32
+#endif
+
+/* MALLOC_OWNER
+ *
+ * set to 1 to keep the task(priority) that allocated each block, with
+ * MALLOC_UCOS. The blocks of a task are chained on a list of their own, so
+ * free_all_for_task() gives them back without walking the rest of the heap.
+ * Costs two words in every block header, and a lock in every malloc and free,
+ * also when the magazine is used. Blocks allocated before OSStart(), from
+ * other heaps, and the pool of malloc_from_isr have no owner. Can not be
+ * combined with SLAB_MAX, as slab objects have no header to keep it in.
+ */
+
+#ifndef MALLOC_OWNER
+#define MALLOC_OWNER      0
+#endif
+
+/* TLSF_FL_MAX
+ *
+ * log2 of the largest block TLSF keeps an exact class for. Larger free blocks
+ * all end up on the last list. 16 covers the 64K of RAM of the LPC2106, every
+ * extra step costs 8 list pointers and a bitmap word.
+ */
+
+#ifndef TLSF_FL_MAX
+#define TLSF_FL_MAX       16
+#endif
+
+/* MALLOC_TRACE, TRACE_SIZE
+ *
+ * set MALLOC_TRACE to 1 to record every malloc, free, calloc, realloc and
+ * memalign call in a ring buffer of TRACE_SIZE records, to be read with
+ * trace_read(), see malloc.h. When the buffer is full, records are lost, and
+ * the number lost is reported with the next record that is read.
+ */
+
+#ifndef MALLOC_TRACE
+#define MALLOC_TRACE      0
+#endif
+#ifndef TRACE_SIZE
+#define TRACE_SIZE        64
+#endif
+
+/* WCET_SITES, WCET_CLOCK
+ *
+ * set WCET_SITES to the number of call sites malloc_wcet() keeps the worst
+ * time of. Every call to malloc, calloc, realloc, memalign and free is timed
+ * with WCET_CLOCK(), a free running counter, e.g. -D'WCET_CLOCK()=T1TC' with
+ * timer 1 started. The host build counts cpu cycles. A site is the return
+ * address of the call, sites that do not fit in the table are not kept. 0
+ * leaves the timing out.
+ */
+
+#ifndef WCET_SITES
+#define WCET_SITES        0
+#endif
+
+/* MALLOC_DEBUG
+ *
+ * set to 1 to check every block that is freed or reallocated. A used block
+ * carries a magic word in its header, which free clears again, so freeing a
+ * block twice, or something malloc never returned, is caught in constant
+ * time. A guard word after every block catches writes past its end, and
+ * freed blocks are filled with DEBUG_POISON, so use after free shows up.
+ * Errors go to the hook set with set_malloc_hook(), and the block is left
+ * alone. Costs a word per block and a fill per free. With 0, none of this is
+ * compiled in.
+ */
+
+#ifndef MALLOC_DEBUG
+#define MALLOC_DEBUG      0
+#endif
+
+/* MALLOC_ISR
+ *
+ * set to 1 to add free_from_isr(), for blocks that are freed in an interrupt.
+ * The block is only pushed on a list, with interrupts masked for a few
+ * instructions, the next malloc() or free() of a task gives the blocks back
+ * to the heap. Without MALLOC_UCOS, masking the interrupts needs ARM mode.
+ */
+
+#ifndef MALLOC_ISR
+#define MALLOC_ISR        0
+#endif
+
+/* ISR_POOL_SIZE, ISR_POOL_COUNT
+ *
+ * with MALLOC_ISR, init_malloc sets ISR_POOL_COUNT blocks of ISR_POOL_SIZE
+ * bytes apart for malloc_from_isr(). It pops one from a stack, and
+ * free_from_isr() pushes it back, both in a few instructions. The pool is
+ * brought back to ISR_POOL_COUNT blocks by flush_isr_frees(). Set
+ * ISR_POOL_COUNT to 0 to leave the pool out.
+ */
+
+#ifndef ISR_POOL_SIZE
+#define ISR_POOL_SIZE     64
+#endif
+#ifndef ISR_POOL_COUNT
+#define ISR_POOL_COUNT    4
+#endif
+
+/* MALLOC_HOST
+ *
+ * set to 1 to build for a PC, see host/. The linker 'end' symbol is then a
+ * static arena, and the stack pointer is simulated by host_stack_ptr.
+ */
+
+#ifndef MALLOC_HOST
+#define MALLOC_HOST       0
+#endif
 
 /*
  * No user serviceable parts behind this point.
  */
  
-/*
- * Where the global function definitions reside:
+/*
+ * Where the global function definitions reside:
+ */
+#if MALLOC_UCOS
+#include "includes.h"
+#endif
+#include "malloc.h"
+
+#if MALLOC_TRACE
+#define TRACE(op, size, mem) trace_put(op, size, mem)
+#else
+#define TRACE(op, size, mem)
+#endif
+
+#if (WCET_SITES > 0) && MALLOC_HOST && !defined(WCET_CLOCK)
+#define WCET_CLOCK()      host_cycles()
+#endif
+#if (WCET_SITES > 0) && !defined(WCET_CLOCK)
+#error "WCET_SITES needs a WCET_CLOCK()"
+#endif
+
+// times a call, from the declaration of WCET_START up to WCET_STOP
+#if WCET_SITES > 0
+#define WCET_START        unsigned int wcet_start = WCET_CLOCK();
+#define WCET_STOP(op)     wcet_put(op, __builtin_return_address(0), WCET_CLOCK() - wcet_start)
+#else
+#define WCET_START
+#define WCET_STOP(op)
+#endif
+
+#if MALLOC_STATS
+#define STATS(statement)  statement
+#else
+#define STATS(statement)
+#endif
+
+#if MALLOC_DEBUG
+#define DEBUG_MAGIC       0x4d616c63//"Malc", mixed with the header address
+#define DEBUG_GUARD       0xa5c3a5c3//the word after a used block
+#define DEBUG_POISON      0xfeeefeee//fills freed blocks
+#define DEBUG_GUARD_SIZE  sizeof(unsigned int)
+#define DEBUG_MARK(mem)   debug_mark(mem)
+#else
+#define DEBUG_MARK(mem)   (mem)
+#endif
+
+#if MALLOC_OWNER
+#define OWNER_TAG(mem)    owner_tag(mem)
+#define OWNER_HEAD(list)  ((memory_block_header *)(list))//its owner_next is the list, see owner_tag()
+#define OWNER_TAKEN(h)    ((h)->owner_prev == (h))//free_all_for_task frees it, see owner_take()
+#else
+#define OWNER_TAG(mem)    (mem)
+#endif
+
+// a block header at 'old' is gone, merged into the one at 'to'. The heap walk
+// must not resume from it, so it goes on from 'to'.
+#define WALKER_MOVE(old, to) \
+    if((active_walker != NULL) && (active_walker->next == (unsigned char *)(old))) \
+        active_walker->next = (unsigned char *)(to)
+
+#if MALLOC_ISR
+// masks the interrupts, keeping the state they were in, in 'cpu_sr'
+#if MALLOC_UCOS
+#if OS_CRITICAL_METHOD == 3
+#define ISR_STATE         OS_CPU_SR cpu_sr = 0;
+#else
+#define ISR_STATE
+#endif
+#define ISR_LOCK()        OS_ENTER_CRITICAL()
+#define ISR_UNLOCK()      OS_EXIT_CRITICAL()
+#elif defined(__arm__) && !MALLOC_HOST
+#define ISR_STATE         unsigned long cpu_sr;
+#define ISR_LOCK()        asm volatile ("mrs %0, cpsr\n\torr r12, %0, #0xc0\n\tmsr cpsr_c, r12" \
+                                        : "=r" (cpu_sr) : : "r12", "memory")//IRQ and FIQ off
+#define ISR_UNLOCK()      asm volatile ("msr cpsr_c, %0" : : "r" (cpu_sr) : "memory")
+#else
+#define ISR_STATE
+#define ISR_LOCK()
+#define ISR_UNLOCK()
+#endif
+
+// gives blocks freed by interrupts back to the heap, FIT_LIMIT at most
+#define ISR_FREES()       do { if((isr_frees != NULL) || (isr_taken != NULL)) \
+                                   drain_isr_frees(FIT_LIMIT); } while(0)
+
+#if ISR_POOL_COUNT > 0
+// size of the blocks of the pool, free_from_isr only takes these back
+#if MALLOC_DEBUG
+#define ISR_POOL_BLOCK    ROUND_SIZE(ISR_POOL_SIZE + DEBUG_GUARD_SIZE)
+#else
+#define ISR_POOL_BLOCK    ROUND_SIZE(ISR_POOL_SIZE)
+#endif
+#endif
+#else
+#define ISR_FREES()
+#endif
+
+#if MALLOC_UCOS
+// only one task at a time may work on the heap
+#define HEAP_LOCK()       OSSchedLock()
+#define HEAP_UNLOCK()     OSSchedUnlock()
+#else
+#define HEAP_LOCK()
+#define HEAP_UNLOCK()
+#endif
+
+
+// Structure that describes a block.
+typedef struct memory_block_header {
+#if MALLOC_OWNER
+    struct memory_block_header  *owner_next;//blocks of the same task, must be first
+    struct memory_block_header  *owner_prev;//NULL if it has no owner
+#endif
+    unsigned int                 size;//means that there is a max of 4 gigs per block
+    struct memory_block_header  *next;
+    /* Actual memory block starts here */
+} memory_block_header;
+
+/*
+ * Block layout
+ *
+ * The low bits of 'size' are flags, as a size is always a multiple of
+ * BLOCK_ALIGN. A free block keeps a pointer to the previous free block in
+ * its first word, and a pointer to its own header in its last word(the
+ * footer), so the block after it can find it when merging. The last block in
+ * the heap is never free, it is given back to the system instead.
+ *
+ * With COMPACT_HEADER, the header ends before 'next', which is the first
+ * word of the block, and the previous free block is in its second word.
+ * 'size' then holds the size of the block with the header, as the block
+ * alone is no multiple of BLOCK_ALIGN anymore.
+ *
+ * With MALLOC_OWNER, the header starts with the links of the list of its
+ * owner, in front of 'size'. A free block does not use them.
+ */
+#define BLOCK_FREE        1//block is on a free list
+#define BLOCK_PREV_FREE   2//block in front of this one is free, its footer is valid
+#define BLOCK_CLEAN       4//block is still zero, only valid until it is freed, see calloc()
+#define BLOCK_FLAGS       (BLOCK_FREE | BLOCK_PREV_FREE | BLOCK_CLEAN)
+
+#if BLOCK_ALIGN < 8
+#error "the block flags need a BLOCK_ALIGN of at least 8"
+#endif
+#if (BLOCK_ALIGN & (BLOCK_ALIGN - 1)) != 0
+#error "BLOCK_ALIGN must be a power of two"
+#endif
+#if (SPLIT_THRESHOLD % BLOCK_ALIGN) != 0
+#error "SPLIT_THRESHOLD must be a multiple of BLOCK_ALIGN"
+#endif
+#if TOP_PAD > TRIM_THRESHOLD
+#error "TOP_PAD may not be larger than TRIM_THRESHOLD"
+#endif
+#if COMPACT_HEADER && MALLOC_DEBUG
+#error "COMPACT_HEADER can not be combined with MALLOC_DEBUG"
+#endif
+#if (SLAB_MAX > 0) && MALLOC_DEBUG
+#error "SLAB_MAX can not be combined with MALLOC_DEBUG"
+#endif
+#if MALLOC_OWNER && !MALLOC_UCOS
+#error "MALLOC_OWNER needs MALLOC_UCOS"
+#endif
+#if MALLOC_OWNER && (SLAB_MAX > 0)
+#error "MALLOC_OWNER can not be combined with SLAB_MAX"
+#endif
+#if (MALLOC_BOUNDED > 0) && MALLOC_TLSF
+#error "MALLOC_BOUNDED is for the first-fit engine, TLSF is bounded allready"
+#endif
+#if (MALLOC_BOUNDED > 0) && (RESERVE_CLASSES < 1)
+#error "RESERVE_CLASSES must be at least 1, set RESERVE_COUNT to 0 for no reserve"
+#endif
+
+#if COMPACT_HEADER
+// the header ends with 'size', and 'size' counts it
+#define HEADER_SIZE       (sizeof(memory_block_header) - sizeof(void *))//up to 'next'
+#define SIZE_BIAS         HEADER_SIZE
+#define BLOCK_SIZE(h)     (((h)->size & ~BLOCK_FLAGS) - SIZE_BIAS)
+#else
+#define HEADER_SIZE       sizeof(memory_block_header)
+#define SIZE_BIAS         0
+#define BLOCK_SIZE(h)     ((h)->size & ~BLOCK_FLAGS)
+#endif
+
+#define SIZE_WORD(size)   ((size) + SIZE_BIAS)//'size' of a block of 'size' bytes, without flags
+#define BLOCK_DATA(h)     ((void *)((char *)(h) + HEADER_SIZE))//what malloc returns for h
+#define BLOCK_HEADER(mem) ((memory_block_header *)((char *)(mem) - HEADER_SIZE))
+#define BLOCK_NEXT(h)     ((memory_block_header *)((char *)BLOCK_DATA(h) + BLOCK_SIZE(h)))
+#define BLOCK_PREV(h)     (((memory_block_header **)(h))[-1])//footer of the block in front of h
+#define FREE_PREV(h)      (((memory_block_header **)&(h)->next)[1])//word after 'next'
+#define BLOCK_BYTES(h)    (BLOCK_SIZE(h) + HEADER_SIZE)//header included
+
+#if MALLOC_DEBUG
+// the 'next' word of a used block, and its last word
+#define BLOCK_MAGIC(h)    ((memory_block_header *)(DEBUG_MAGIC ^ (unsigned long)(h)))
+#define BLOCK_GUARD(h)    (((unsigned int *)BLOCK_NEXT(h))[-1])
+#endif
+
+// a free block must hold its prev pointer and footer(and 'next', with
+// COMPACT_HEADER), and end on a multiple of BLOCK_ALIGN
+#define MIN_BLOCK_SIZE    (((sizeof(memory_block_header) + (2 * sizeof(void *)) + BLOCK_ALIGN - 1) & \
+                            ~(BLOCK_ALIGN - 1)) - HEADER_SIZE)
+
+// the smallest rest that is split off a block, see SPLIT_THRESHOLD
+#define SPLIT_MIN         ((SPLIT_THRESHOLD) > MIN_BLOCK_SIZE ? (SPLIT_THRESHOLD) : MIN_BLOCK_SIZE)
+
+// larger blocks never fit, and would overflow the int that _sbrk() takes
+#define MAX_BLOCK_SIZE    (0x40000000 - BLOCK_ALIGN - SIZE_BIAS)
+
+// a size asked for, as a block size: rounded up so the block ends on a
+// multiple of BLOCK_ALIGN, and large enough to hold the free list links later
+// on. Sizes over MAX_BLOCK_SIZE become MAX_BLOCK_SIZE, so they do not wrap
+// around, and fail.
+#define ROUND_SIZE(size)  ((size) <= MIN_BLOCK_SIZE ? MIN_BLOCK_SIZE : \
+                           (size) > MAX_BLOCK_SIZE ? MAX_BLOCK_SIZE : \
+                           ((((size) + HEADER_SIZE + (BLOCK_ALIGN - 1)) & ~(BLOCK_ALIGN - 1)) - HEADER_SIZE))
+
+// takes a free block from the free list of the engine, and puts a used one
+// back merged(so never on a quick list)
+#if MALLOC_TLSF
+#define FREE_BLOCK_REMOVE(h)  tlsf_remove(h)
+#define FREE_BLOCK_RELEASE(h) engine_free(h)
+#else
+#define FREE_BLOCK_REMOVE(h)  free_list_remove(h)
+#define FREE_BLOCK_RELEASE(h) release_block(h)
+#endif
+
+// bytes to add to 'p' to get it on a multiple of 'a'(a power of two)
+#define ALIGN_PAD(p, a)   (((a) - ((unsigned long)(p) & ((a) - 1))) & ((a) - 1))
+
+// most free blocks one search looks at, see MALLOC_BOUNDED. A search that
+// gives up sets fit_cut, so a failed malloc can tell why.
+#if MALLOC_BOUNDED > 0
+#define FIT_LIMIT         ((unsigned int)(MALLOC_BOUNDED))
+#define FIT_CUT()         (fit_cut = 1)
+#else
+#define FIT_LIMIT         (~0U)
+#define FIT_CUT()
+#endif
+
+#if MALLOC_BOUNDED > 0
+// size of the blocks of reserve class 'i'
+#if MALLOC_DEBUG
+#define RESERVE_SIZE(i)   ROUND_SIZE(((unsigned int)(RESERVE_MIN) << (i)) + DEBUG_GUARD_SIZE)
+#else
+#define RESERVE_SIZE(i)   ROUND_SIZE((unsigned int)(RESERVE_MIN) << (i))
+#endif
+// the block belongs to the reserve, which init_malloc put at the start of the
+// default heap
+#define RESERVE_BLOCK(h)  ((current_heap == &default_heap) && \
+                           ((unsigned char *)(h) >= reserve_low) && ((unsigned char *)(h) < reserve_high))
+// why the last malloc of the calling task failed, see malloc_error()
+#if MALLOC_UCOS
+#define MALLOC_ERROR      malloc_errors[OSRunning ? OSPrioCur : OS_LOWEST_PRIO]
+#else
+#define MALLOC_ERROR      malloc_errors[0]
+#endif
+#endif
+
+#if MALLOC_TLSF
+#undef  QUICK_LIST_MAX
+#define QUICK_LIST_MAX    0
+
+/*
+ * TLSF lookup tables
+ *
+ * Every first level list covers a power of two, split up in TLSF_SL_COUNT
+ * second level lists. Blocks under TLSF_SMALL_BLOCK are on the first list,
+ * with a second level list per BLOCK_ALIGN step.
+ */
+#define TLSF_SL_LOG2      3
+#define TLSF_SL_COUNT     (1 << TLSF_SL_LOG2)
+#if BLOCK_ALIGN == 8
+#define TLSF_FL_SHIFT     6//log2 of TLSF_SMALL_BLOCK
+#elif BLOCK_ALIGN == 16
+#define TLSF_FL_SHIFT     7
+#elif BLOCK_ALIGN == 32
+#define TLSF_FL_SHIFT     8
+#else
+#error "no TLSF_FL_SHIFT for this BLOCK_ALIGN"
+#endif
+#define TLSF_SMALL_BLOCK  (1 << TLSF_FL_SHIFT)
+#define TLSF_FL_COUNT     (TLSF_FL_MAX - TLSF_FL_SHIFT + 1)
+
+#if TLSF_SMALL_BLOCK != (BLOCK_ALIGN * TLSF_SL_COUNT)
+#error "TLSF_FL_SHIFT does not match BLOCK_ALIGN"
+#endif
+#if (TLSF_FL_COUNT < 1) || (TLSF_FL_COUNT > 31)
+#error "TLSF_FL_MAX out of range"
+#endif
+#endif
+
+
+#if QUICK_LIST_MAX > 0
+// number of quick lists, and the list a block of 'size' bytes belongs on
+#define QUICK_LIST_COUNT  ((int)((QUICK_LIST_MAX) >= MIN_BLOCK_SIZE ? \
+                                 ((QUICK_LIST_MAX) - MIN_BLOCK_SIZE) / BLOCK_ALIGN + 1 : 1))
+#define QUICK_INDEX(size) (((size) - MIN_BLOCK_SIZE) / BLOCK_ALIGN)
+#endif
+
+#if SLAB_MAX > 0
+// a slab, in front of its slots
+typedef struct slab {
+    struct slab                 *next;//next slab of the same size with a free slot
+    unsigned int                 free_map;//bit set for every free slot
+    unsigned short               slot_size;
+    unsigned short               index;//in slabs[], see slab_of()
+} slab;
+
+#define SLAB_HEADER       ((sizeof(slab) + BLOCK_ALIGN - 1) & ~(BLOCK_ALIGN - 1))
+#define SLAB_CLASSES      ((SLAB_MAX) / BLOCK_ALIGN)//one list per slot size
+#define SLAB_SLOTS(size)  ((SLAB_BYTES - SLAB_HEADER) / (size) > 32 ? 32 : \
+                           (SLAB_BYTES - SLAB_HEADER) / (size))
+#define SLAB_EMPTY(size)  (SLAB_SLOTS(size) == 32 ? ~0U : (1U << SLAB_SLOTS(size)) - 1)//all free
+
+#if (SLAB_MAX % BLOCK_ALIGN) != 0
+#error "SLAB_MAX must be a multiple of BLOCK_ALIGN"
+#endif
+#if (SLAB_BYTES & (SLAB_BYTES - 1)) != 0
+#error "SLAB_BYTES must be a power of two"
+#endif
+#if SLAB_BYTES < (4 * SLAB_MAX)
+#error "SLAB_BYTES must be at least four times SLAB_MAX"
+#endif
+#endif
+
+
+/*
+ * Global variabeles
+ *
+ * These variabeles are used by the functions to keep track of information as
+ * where the heap begins and ends, how far it may grow, and where free memory
+ * is located. They are kept per heap in a struct heap, so there can be more
+ * than one, see heap_create(). The functions work on current_heap, which is
+ * the default heap(from 'end' up to the stack), unless heap_malloc() or
+ * heap_free() switched it for a call, with the heap locked. The defines below
+ * give the members of current_heap their short names.
+ */
+
+struct heap {
+#if MALLOC_TLSF
+    unsigned int                 tlsf_fl_bitmap;//bit set for every first level with free blocks
+    unsigned int                 tlsf_sl_bitmap[TLSF_FL_COUNT];//bit set for every non-empty list
+    memory_block_header         *tlsf_blocks[TLSF_FL_COUNT][TLSF_SL_COUNT];//free lists
+#else
+    memory_block_header         *free_memory_blocks;//this is the pointer to the start of the free list
+    memory_block_header         *free_memory_tail;//and to the end of it, freed blocks are added here
+    memory_block_header         *free_rover;//where the next FIT_NEXT search starts
+    unsigned int                 fit_policy;//see malloc_set_policy()
+#if MALLOC_STATS
+    unsigned int                 fit_searches[FIT_COUNT];//free list searches, per policy
+    unsigned int                 fit_visits[FIT_COUNT];//free blocks looked at in them
+    unsigned int                 fit_worst[FIT_COUNT];//most blocks looked at in one search
+    unsigned int                 call_visits;//blocks looked at and flushed in this malloc
+    unsigned int                 call_worst;//most of them in one malloc or memalign
+#endif
+#endif
+#if QUICK_LIST_MAX > 0
+    memory_block_header         *quick_lists[QUICK_LIST_COUNT];//unmerged small free blocks, by size
+#endif
+    unsigned char               *heap_start;//first block of the heap
+    unsigned char               *heap_end;//current heap size
+    unsigned char               *heap_top;//claimed heap size, see TRIM_THRESHOLD
+    unsigned char               *heap_limit;//maximum heap size
+#if CALLOC_ZERO_HEAP
+    unsigned char               *heap_clean;//memory from here up to clean_end was never used, and is zero
+    unsigned char               *clean_end;
+#endif
+    heap_walker                 *active_walker;//walk in progress, see heap_walk()
+    
+    // running counters for malloc_stats(), in bytes with the headers included
+    unsigned char               *peak_end;//highest heap_end since the heap was started
+#if MALLOC_STATS
+    unsigned int                 free_size;//in free blocks on the free list(s)
+    unsigned int                 free_count;
+    unsigned int                 cached_size;//in blocks on the quick lists
+    unsigned int                 failed_count;//allocations that returned NULL
+#endif
+};
+
+heap default_heap;//from 'end' up to the stack, see init_malloc()
+heap *current_heap = &default_heap;
+
+#if MALLOC_TLSF
+#define tlsf_fl_bitmap      (current_heap->tlsf_fl_bitmap)
+#define tlsf_sl_bitmap      (current_heap->tlsf_sl_bitmap)
+#define tlsf_blocks         (current_heap->tlsf_blocks)
+#else
+#define free_memory_blocks  (current_heap->free_memory_blocks)
+#define free_memory_tail    (current_heap->free_memory_tail)
+#define free_rover          (current_heap->free_rover)
+#define fit_policy          (current_heap->fit_policy)
+#define fit_searches        (current_heap->fit_searches)
+#define fit_visits          (current_heap->fit_visits)
+#define fit_worst           (current_heap->fit_worst)
+#define call_visits         (current_heap->call_visits)
+#define call_worst          (current_heap->call_worst)
+#endif
+#define quick_lists         (current_heap->quick_lists)
+#define heap_start          (current_heap->heap_start)
+#define heap_end            (current_heap->heap_end)
+#define heap_top            (current_heap->heap_top)
+#define heap_limit          (current_heap->heap_limit)
+#define heap_clean          (current_heap->heap_clean)
+#define clean_end           (current_heap->clean_end)
+#define active_walker       (current_heap->active_walker)
+#define peak_end            (current_heap->peak_end)
+#define free_size           (current_heap->free_size)
+#define free_count          (current_heap->free_count)
+#define cached_size         (current_heap->cached_size)
+#define failed_count        (current_heap->failed_count)
+
+#if MALLOC_HOST
+extern unsigned char * host_stack_ptr;//top of the simulated stack
+extern unsigned int host_cycles(void);//the cpu cycle counter
+#endif
+
+#if MALLOC_DEBUG
+void (*debug_hook)(int error, void *mem);//see set_malloc_hook()
+#endif
+
+#if MALLOC_UCOS
+// blocks freed by a task, kept for its next malloc
+typedef struct magazine {
+    memory_block_header         *blocks;//linked by 'next', unmerged
+    unsigned int                 count;
+} magazine;
+
+magazine magazines[OS_LOWEST_PRIO + 1];//one per task priority
+#endif
+
+#if MALLOC_OWNER
+memory_block_header *owner_lists[OS_LOWEST_PRIO + 1];//blocks of each task priority
+#endif
+
+#if SLAB_MAX > 0
+slab *slab_lists[SLAB_CLASSES];//slabs with a free slot, by slot size
+slab *slabs[SLAB_COUNT];//all slabs of the default heap, NULL if unused
+slab *slab_low;//lowest and highest slab so far, see slab_of()
+slab *slab_high;
+#endif
+
+#if MALLOC_ISR
+void * volatile isr_frees;//blocks freed by interrupts, linked by their first word
+void *isr_taken;//taken from isr_frees, but not given back yet, see drain_isr_frees()
+#if ISR_POOL_COUNT > 0
+void * volatile isr_pool;//free blocks of the pool, linked by their first word
+volatile unsigned int isr_pool_count;
+#endif
+#endif
+
+#if MALLOC_BOUNDED > 0
+memory_block_header *reserve_lists[RESERVE_CLASSES];//free blocks of the reserve, by size
+unsigned char *reserve_low;//the reserve lies between these, see RESERVE_BLOCK()
+unsigned char *reserve_high;
+unsigned char fit_cut;//a search gave up in this call, see FIT_LIMIT
+#if MALLOC_UCOS
+unsigned char malloc_errors[OS_LOWEST_PRIO + 1];//per task priority, see MALLOC_ERROR
+#else
+unsigned char malloc_errors[1];
+#endif
+#endif
+
+#if WCET_SITES > 0
+wcet_site wcet_table[WCET_SITES];//hashed by site, see wcet_put()
+#endif
+
+#if MALLOC_TRACE
+trace_record trace_buffer[TRACE_SIZE];//ring buffer of the trace
+unsigned int trace_head;//number of records written, and read
+unsigned int trace_tail;
+unsigned int trace_lost;//records that did not fit since the last read
+#endif
+
+
+/*
+ * Local function prototypes
+ *
+ * These functions may be acessible from the outside, as they can break stuff.
+ */
+
+/* _sbrk
+ *
+ * function that actually claims/releases a piece of memory between _end and stack.
+ * partly copied from the libgloss library(arm port)
+ */
+volatile unsigned char * _sbrk (int incr);
+
+/* heap_reset
+ *
+ * starts current_heap as an empty heap from 'start' up to 'limit'.
+ */
+static void heap_reset(unsigned char *start, unsigned char *limit);
+
+/* get_block, put_block, resize_block, get_aligned_block
+ *
+ * do the work of malloc, free, realloc and memalign, without tracing it.
+ */
+static void * get_block(unsigned int size);
+static void put_block(void * mem_chunk);
+static void * resize_block(void * mem_chunk, unsigned int size);
+static void * get_aligned_block(unsigned int align, unsigned int size);
+
+#if MALLOC_ISR
+/* drain_isr_frees
+ *
+ * gives up to 'count' blocks freed by interrupts back to the heap.
+ */
+static void drain_isr_frees(unsigned int count);
+
+#if ISR_POOL_COUNT > 0
+/* fill_isr_pool
+ *
+ * brings the pool of malloc_from_isr back to ISR_POOL_COUNT blocks.
+ */
+static void fill_isr_pool(void);
+#endif
+#endif
+
+#if MALLOC_TRACE
+/* trace_put
+ *
+ * adds a record to the trace.
+ */
+static void trace_put(unsigned char op, unsigned int size, void *mem);
+#endif
+
+#if WCET_SITES > 0
+/* wcet_put
+ *
+ * adds a call of 'ticks' long to its site in the table.
+ */
+static void wcet_put(unsigned char op, void *site, unsigned int ticks);
+#endif
+
+/* engine_malloc
+ *
+ * takes a block of 'size' bytes(allready aligned) from the heap. The heap must
+ * be locked.
+ */
+static void * engine_malloc(unsigned int size);
+
+/* engine_free
+ *
+ * gives a block back to the heap. The heap must be locked.
+ */
+static void engine_free(memory_block_header *h);
+
+/* walk_block
+ *
+ * takes the next block of a heap walk, and adds it to its summary. The heap
+ * must be locked. Returns 0 if the walk is done.
+ */
+static int walk_block(heap_walker *walker, heap_block *block);
+
+#if MALLOC_DEBUG
+/* debug_mark, debug_check, debug_error
+ *
+ * mark a block as handed out, check a block that is given back, and report
+ * an error to the hook.
+ */
+static void * debug_mark(void *mem);
+static int debug_check(void *mem);
+static void debug_error(int error, void *mem);
+#endif
+
+/* heap_resize
+ *
+ * resizes a used block to 'size' bytes(allready aligned) without moving it.
+ * Returns 0 if it can not grow where it is. The heap must be locked.
+ */
+static int heap_resize(memory_block_header *h, unsigned int size);
+
+/* split_block
+ *
+ * cuts a used block down to 'size' bytes, and gives the rest back to the heap
+ * if it is large enough to be a block of its own. The heap must be locked.
+ */
+static void split_block(memory_block_header *h, unsigned int size);
+
+/* heap_grow
+ *
+ * claims a new block of 'size' bytes at the end of the heap. Returns NULL if
+ * there is no memory available anymore. The heap must be locked.
+ */
+static memory_block_header * heap_grow(unsigned int size);
+
+/* engine_memalign
+ *
+ * takes an 'align' aligned block of 'size' bytes(allready aligned) from the
+ * heap. The heap must be locked.
+ */
+static void * engine_memalign(unsigned int size, unsigned int align);
+
+/* align_block
+ *
+ * cuts an 'align' aligned block of 'size' bytes out of a used block, and gives
+ * the slack in front of and after it back to the heap. The used block must be
+ * large enough. The heap must be locked.
+ */
+static void * align_block(memory_block_header *h, unsigned int size, unsigned int align);
+
+/* zero_words
+ *
+ * clears 'size' bytes(a multiple of the word size) at 'mem'.
+ */
+static void zero_words(void *mem, unsigned int size);
+
+#if MALLOC_UCOS
+/* magazine_get
+ *
+ * takes a block of 'size' bytes from the magazine of the running task.
+ * Returns NULL if it has none.
+ */
+static void * magazine_get(unsigned int size);
+
+/* magazine_put
+ *
+ * puts a block in the magazine of the running task, emptying it first if it
+ * is full. Returns 0 if the block should go back to the heap instead.
+ */
+static int magazine_put(memory_block_header *h);
+
+/* drain_magazine
+ *
+ * gives all blocks in a magazine back to the heap.
+ */
+static void drain_magazine(magazine *m);
+#endif
+
+#if MALLOC_OWNER
+/* owner_tag, owner_untag
+ *
+ * put a block on the list of the running task, and take it off again.
+ */
+static void * owner_tag(void *mem);
+static void owner_untag(memory_block_header *h);
+
+/* owner_put
+ *
+ * puts a block without an owner on the list of task 'prio'. The heap must be
+ * locked.
+ */
+static void owner_put(memory_block_header *h, unsigned int prio);
+
+/* owner_take
+ *
+ * takes the first block off the list of task 'prio', see free_all_for_task.
+ * Returns NULL if the list is empty. The heap must be locked.
+ */
+static memory_block_header * owner_take(unsigned int prio);
+#endif
+
+#if SLAB_MAX > 0
+/* slab_get
+ *
+ * takes an object of 'size' bytes from a slab, and starts a new slab if
+ * there is none with a free slot. Returns NULL if that fails.
+ */
+static void * slab_get(unsigned int size);
+
+/* slab_put
+ *
+ * gives an object back to its slab, and the slab back to the heap if it is
+ * empty then.
+ */
+static void slab_put(slab *s, void *mem);
+
+/* slab_of
+ *
+ * returns the slab 'mem' was taken from, or NULL if it is no slab object.
+ */
+static slab * slab_of(void *mem);
+#endif
+
+#if MALLOC_BOUNDED > 0
+/* reserve_fill
+ *
+ * sets the blocks of the reserve apart, on an empty default heap.
+ */
+static void reserve_fill(void);
+
+/* reserve_get
+ *
+ * takes a block of at least 'size' bytes(allready aligned) from the reserve.
+ * Returns NULL if it has none. The heap must be locked.
+ */
+static void * reserve_get(unsigned int size);
+
+/* reserve_put
+ *
+ * gives a block back to the reserve. The heap must be locked.
+ */
+static void reserve_put(memory_block_header *h);
+#endif
+
+#if MALLOC_TLSF || (SLAB_MAX > 0)
+/* fls_word
+ *
+ * returns the number of the highest bit set in 'word', or -1 if it is 0.
+ */
+static int fls_word(unsigned int word);
+#endif
+
+#if MALLOC_TLSF
+
+/* tlsf_mapping
+ *
+ * calculates the first and second level list a block of 'size' bytes is kept on.
+ */
+static void tlsf_mapping(unsigned int size, int *fl, int *sl);
+
+/* tlsf_find
+ *
+ * finds a free block of at least 'size' bytes, and takes it from its list.
+ * Returns NULL if there is none.
+ */
+static memory_block_header * tlsf_find(unsigned int size);
+
+/* tlsf_insert
+ *
+ * puts a free block on the list for its size.
+ */
+static void tlsf_insert(memory_block_header *h);
+
+/* tlsf_remove
+ *
+ * takes a free block from its list.
+ */
+static void tlsf_remove(memory_block_header *h);
+
+#else
+/* list_fit
+ *
+ * takes a block of 'size' bytes(allready aligned) from the free list, and
+ * claims a new piece of heap if nothing fits.
+ */
+static void * list_fit(unsigned int size);
+
+/* free_list_find
+ *
+ * searches the free list for a block of 'size' bytes, see MALLOC_FIT.
+ */
+static memory_block_header * free_list_find(unsigned int size);
+
+/* aligned_fit
+ *
+ * searches the free list for a block that holds 'size' bytes on an 'align'
+ * boundary, and takes it from the list. Returns NULL if nothing fits.
+ */
+static memory_block_header * aligned_fit(unsigned int size, unsigned int align);
+
+/* release_block
+ *
+ * puts a block back in the free list, merging it with its neighbours, and
+ * gives it back to the system if it ends up at the end of the heap.
+ */
+static void release_block(memory_block_header *h);
+
+/* free_list_insert
+ *
+ * puts a free block on the end of the free list.
+ */
+static void free_list_insert(memory_block_header *h);
+
+/* free_list_remove
+ *
+ * takes a free block from the free list.
+ */
+static void free_list_remove(memory_block_header *h);
+
+#if QUICK_LIST_MAX > 0
+/* flush_quick_lists
+ *
+ * feeds up to 'count' blocks on the quick lists back into the free list, so
+ * they can be merged. Returns 0 if there was nothing to flush.
+ */
+static int flush_quick_lists(unsigned int count);
+#endif
+#endif
+
+
+
+/*
+ * Function implementations
+ */
+
+/* init_malloc
+ *
+ * call to initialise heap space, goes from _end to stack, grows upwards.
+ *
+ * WARNING: makes use of current maximum stack size. If origin of call is
+ * from within a separated stack, which is not located after the heap space
+ * (_end), this will return with an error code(-2).
+ */ 
+ 
+int init_malloc(void)
+{
+#if MALLOC_HOST
+    unsigned char * stack_ptr = host_stack_ptr;//simulated stack, see host/host.c
+#else
+    register unsigned char * stack_ptr asm ("sp");//pointer to maximum stack size
+#endif
+    extern unsigned char   end asm ("end");/* Defined by the linker. heap comes */
+
+    if((stack_ptr - STACK_MARGIN) < (& end))
+        return -2;//maximum stack size is under _end, so no heap is available
+    
+    current_heap = &default_heap;
+    heap_reset(& end, stack_ptr - STACK_MARGIN);//do it now
+#if CALLOC_ZERO_HEAP
+    heap_clean = heap_limit;//nothing is zero yet, see below
+#endif
+#if MALLOC_DEBUG
+    debug_hook = NULL;
+#endif
+#if MALLOC_TRACE
+    trace_head = 0;
+    trace_tail = 0;
+    trace_lost = 0;
+#endif
+#if MALLOC_UCOS
+    {
+        int i;
+        for(i = 0; i <= OS_LOWEST_PRIO; i++)
+        {
+            magazines[i].blocks = NULL;
+            magazines[i].count = 0;
+#if MALLOC_OWNER
+            owner_lists[i] = NULL;
+#endif
+        }
+    }
+#endif
+#if SLAB_MAX > 0
+    {
+        int i;
+        for(i = 0; i < SLAB_CLASSES; i++)
+            slab_lists[i] = NULL;
+        for(i = 0; i < SLAB_COUNT; i++)
+            slabs[i] = NULL;
+        slab_low = NULL;
+        slab_high = NULL;
+    }
+#endif
+#if WCET_SITES > 0
+    {
+        int i;
+        for(i = 0; i < WCET_SITES; i++)
+        {
+            wcet_table[i].site = NULL;
+            wcet_table[i].calls = 0;
+            wcet_table[i].worst = 0;
+        }
+    }
+#endif
+#if MALLOC_BOUNDED > 0
+    reserve_fill();//first, so it is at the start of the heap
+#endif
+#if MALLOC_ISR
+    isr_frees = NULL;
+    isr_taken = NULL;
+#if ISR_POOL_COUNT > 0
+    isr_pool = NULL;
+    isr_pool_count = 0;
+    fill_isr_pool();
+#endif
+#endif
+#if CALLOC_ZERO_HEAP
+    //zero the rest once, so calloc does not have to for memory never used. Done
+    //last, the calls above used the stack under stack_ptr
+    if((unsigned int)(heap_limit - heap_end) > CLEAN_MARGIN)
+        clean_end = heap_limit - CLEAN_MARGIN;//the caller will use the stack under it
+    else
+        clean_end = heap_end;
+    zero_words(heap_end, (clean_end - heap_end) & ~(sizeof(unsigned int) - 1));
+    heap_clean = heap_end;
+#endif
+    return 0;
+}
+
+
+/* heap_create
+ *
+ * call to start an extra heap in the 'len' bytes at 'base', see malloc.h. The
+ * struct heap is kept at the start of the region, the blocks follow it. The
+ * heap grows from there up to the end of the region, just as the default heap
+ * grows up to the stack.
+ */
+
+heap * heap_create(void *base, unsigned int len)
+{
+    unsigned int pad = ALIGN_PAD(base, BLOCK_ALIGN);//the blocks must be aligned
+    unsigned int room = (sizeof(heap) + BLOCK_ALIGN - 1) & ~(BLOCK_ALIGN - 1);
+    unsigned char *start;
+    heap *h;
+    
+    if((base == NULL) || (len < pad + room + HEADER_SIZE + MIN_BLOCK_SIZE))
+        return NULL;//no room for a single block
+    
+    h = (heap *)((unsigned char *)base + pad);
+    start = (unsigned char *)h + room;
+#if CALLOC_ZERO_HEAP
+    zero_words(start, (len - pad - room) & ~(sizeof(unsigned int) - 1));
+#endif
+    
+    HEAP_LOCK();
+    current_heap = h;
+    heap_reset(start, (unsigned char *)base + len);
+    current_heap = &default_heap;
+    HEAP_UNLOCK();
+    return h;
+}
+
+
+/* update_heap_size
+ *
+ * call if global stack is changed, to keep heap out of the stack space
+ *
+ * WARNING: makes use of current maximum stack size. If origin of call is
+ * from within a separated stack, which is not located after the heap space
+ * (_end), this will return with an error code(-2).
+ * 
+ * If new maximum stack pointer is allready in the used portion of the heap,
+ * or in the memory the heap keeps above it(see malloc_trim), this will return
+ * with an error code(-1)
+ */ 
+ 
+int update_heap_size(void)
+{
+#if MALLOC_HOST
+    unsigned char * stack_ptr = host_stack_ptr;//simulated stack, see host/host.c
+#else
+    register unsigned char * stack_ptr asm ("sp");//pointer to maximum stack size
+#endif
+    extern unsigned char   end asm ("end");/* Defined by the linker. heap comes */
+    
+    if((stack_ptr - STACK_MARGIN) < (& end))
+        return -2;//new maximum stack pointer lies beneath begining of heap(under _end).
+    
+    if(heap_top>(stack_ptr - STACK_MARGIN))
+        return -1;//new maximum stack pointer is allready in used memory space
+        
+    heap_limit=(stack_ptr - STACK_MARGIN);
+#if CALLOC_ZERO_HEAP
+    if(clean_end > heap_limit)//the stack may have used it
+        clean_end = heap_limit;
+#endif
+    return 0;//all is well, heap maximum is changed.
+}
+
+
+/* malloc_trim
+ *
+ * call to give the memory above heap_end back to the stack, except for 'pad'
+ * bytes. The quick lists are merged into the free list first, so blocks
+ * cached at the end of the heap are given back as well.
+ *
+ * Returns 1 if any memory was given back, 0 otherwise.
+ */
+
+int malloc_trim(unsigned int pad)
+{
+    int trimmed = 0;
+    
+    HEAP_LOCK();
+#if !MALLOC_TLSF && (QUICK_LIST_MAX > 0)
+    flush_quick_lists(~0U);
+#endif
+    if((unsigned int)(heap_top - heap_end) > pad)
+    {
+        heap_top = heap_end + pad;
+        trimmed = 1;
+    }
+    HEAP_UNLOCK();
+    return trimmed;
+}
+
+
+/* malloc
+ *
+ * call to allocate a block of memory. Tries to keep the heap small, using first-
+ * fit strategy, while not claiming any excess memory. Blocks are a multiple of
+ * BLOCK_ALIGN, to avoid data exeptions on the ARM.
+ * Small blocks(up to QUICK_LIST_MAX) are taken from the quick lists first, and
+ * with MALLOC_UCOS from the magazine of the calling task before that. Tiny
+ * objects(up to SLAB_MAX) are taken from a slab before all that.
+ *
+ * If an error occured, or there is no memory available anymore;
+ * this returns NULL.
+ *
+ * (where the piece fits best keeps fragmentation lower, at the cost of a
+ * longer search, see malloc_set_policy)
+ */
+ 
+void * malloc(unsigned int size)
+{
+    void *mem;
+    WCET_START
+    
+    ISR_FREES();
+    mem = get_block(size);
+    TRACE(TRACE_MALLOC, size, mem);
+    WCET_STOP(TRACE_MALLOC);
+    return mem;
+}
+
+
+/* free
+ * 
+ * call to free a block of memory, that is allocated by malloc. Merges it with
+ * the free blocks in front of and after it, and resizes heap if memory is freed
+ * at the end of the heap. Small blocks are put on their quick list instead,
+ * unmerged, or with MALLOC_UCOS in the magazine of the calling task. Slab
+ * objects go back to their slab.
+ */
+ 
+void free(void * mem_chunk)
+{
+    WCET_START
+    
+    ISR_FREES();
+    TRACE(TRACE_FREE, 0, mem_chunk);
+    put_block(mem_chunk);
+    WCET_STOP(TRACE_FREE);
+}
+
+
+/* calloc
+ *
+ * call to allocate a block of memory for 'count' elements of 'size' bytes,
+ * cleared to zero. Blocks the heap grows into for the first time are allready
+ * zero with CALLOC_ZERO_HEAP, and are not cleared again. Recycled blocks are
+ * cleared a few words at a time.
+ *
+ * If an error occured, or there is no memory available anymore;
+ * this returns NULL.
+ */
+ 
+void * calloc(unsigned int count, unsigned int size)
+{
+    memory_block_header *h;
+#if SLAB_MAX > 0
+    slab *s;
+#endif
+    void *mem;
+    WCET_START
+    
+    if((size > 0) && (count > (~0U / size)))//would not fit in an unsigned int
+        return NULL;
+    
+    mem = get_block(count * size);
+    TRACE(TRACE_CALLOC, count * size, mem);
+    if(mem == NULL)
+    {
+        WCET_STOP(TRACE_CALLOC);
+        return NULL;
+    }
+    
+#if SLAB_MAX > 0
+    s = slab_of(mem);
+    if(s != NULL)//slots are allways recycled
+    {
+        zero_words(mem, s->slot_size);
+        WCET_STOP(TRACE_CALLOC);
+        return mem;
+    }
+#endif
+    h = BLOCK_HEADER(mem);   // Back up to the header itself
+#if MALLOC_DEBUG
+    if(!(h->size & BLOCK_CLEAN))
+        zero_words(mem, BLOCK_SIZE(h) - DEBUG_GUARD_SIZE);//not the guard word
+#else
+    if(!(h->size & BLOCK_CLEAN))
+        zero_words(mem, BLOCK_SIZE(h));
+#endif
+    WCET_STOP(TRACE_CALLOC);
+    return mem;
+}
+
+
+/* realloc
+ *
+ * call to resize a block of memory, that is allocated by malloc. The block is
+ * shrunk in place, and grown in place if the block after it is free or if it
+ * is the last block in heap. Only if that is not possible, a new block is
+ * allocated, and the data is copied over a word at a time.
+ *
+ * Returns the (possibly moved) block, or NULL if there is no memory available
+ * anymore, in which case the old block is left as it was. A NULL pointer acts
+ * as malloc, a size of 0 as free.
+ */
+ 
+void * realloc(void * mem_chunk, unsigned int size)
+{
+    void *mem;
+    WCET_START
+    
+    mem = resize_block(mem_chunk, size);
+    TRACE(TRACE_ARG, 0, mem_chunk);//the old block
+    TRACE(TRACE_REALLOC, size, mem);
+    WCET_STOP(TRACE_REALLOC);
+    return mem;
+}
+
+
+/* memalign
+ *
+ * call to allocate a block of memory that starts on a multiple of 'align'
+ * bytes, which must be a power of two. The free list is searched for a block
+ * that holds it at an aligned spot (or with TLSF, a block large enough to
+ * hold it anywhere is taken), else the heap is grown. The slack in front of
+ * and after the block is given back to the heap as free blocks.
+ *
+ * If an error occured, 'align' is not a power of two, or there is no memory
+ * available anymore; this returns NULL.
+ */
+ 
+void * memalign(unsigned int align, unsigned int size)
+{
+    void *mem;
+    WCET_START
+    
+    mem = get_aligned_block(align, size);
+    TRACE(TRACE_ARG, align, NULL);
+    TRACE(TRACE_MEMALIGN, size, mem);
+    WCET_STOP(TRACE_MEMALIGN);
+    return mem;
+}
+
+
+/* aligned_alloc
+ *
+ * the C11 name of memalign.
+ */
+ 
+void * aligned_alloc(unsigned int align, unsigned int size)
+{
+    return memalign(align, size);
+}
+
+
+/* heap_malloc
+ *
+ * call to allocate a block of memory from heap 'h', as malloc does from the
+ * default heap. A NULL heap is the default heap. The calls on other heaps are
+ * not traced, and do not use the magazines.
+ */
+
+void * heap_malloc(heap *h, unsigned int size)
+{
+    void *mem;
+    
+    if(h == NULL)
+        return malloc(size);
+    
+    HEAP_LOCK();//current_heap is the same for all tasks
+    current_heap = h;
+    mem = get_block(size);
+    current_heap = &default_heap;
+    HEAP_UNLOCK();
+    return mem;
+}
+
+
+/* heap_free
+ *
+ * call to free a block of memory that heap_malloc took from heap 'h'. A block
+ * of another heap is not in its range, and is ignored.
+ */
+
+void heap_free(heap *h, void * mem_chunk)
+{
+    if(h == NULL)
+    {
+        free(mem_chunk);
+        return;
+    }
+    
+    HEAP_LOCK();
+    current_heap = h;
+    put_block(mem_chunk);
+    current_heap = &default_heap;
+    HEAP_UNLOCK();
+}
+
+
+/* get_block
+ *
+ * does the work of malloc.
+ */
+ 
+static void * get_block(unsigned int size)
+{
+    void *mem;
+    
+    if(size<1)//no memory asked, so no pointer returned.
+        return NULL;
+#if SLAB_MAX > 0
+    if(size <= SLAB_MAX && current_heap == &default_heap)
+    {
+        mem = slab_get(size);
+        if(mem != NULL)
+            return mem;
+    }
+#endif
+#if MALLOC_DEBUG
+    if(size <= MAX_BLOCK_SIZE)//room for the guard word, without wrapping around
+        size += DEBUG_GUARD_SIZE;
+#endif
+    
+    size = ROUND_SIZE(size);//a multiple of BLOCK_ALIGN, so the next block is aligned too
+
+#if MALLOC_UCOS
+    mem = magazine_get(size);
+    if(mem != NULL)
+        return OWNER_TAG(DEBUG_MARK(mem));
+#endif
+
+    HEAP_LOCK();
+#if MALLOC_BOUNDED > 0
+    fit_cut = 0;
+#endif
+#if !MALLOC_TLSF && MALLOC_STATS
+    call_visits = 0;
+#endif
+    mem = engine_malloc(size);
+#if !MALLOC_TLSF && MALLOC_STATS
+    if(call_visits > call_worst)
+        call_worst = call_visits;
+#endif
+#if MALLOC_BOUNDED > 0
+    if(mem == NULL && current_heap == &default_heap)
+        mem = reserve_get(size);
+    if(mem == NULL)
+        MALLOC_ERROR = fit_cut ? MALLOC_TIME_BOUND : MALLOC_NO_MEMORY;
+#endif
+#if MALLOC_STATS
+    if(mem == NULL)
+        failed_count++;
+#endif
+    HEAP_UNLOCK();
+    return OWNER_TAG(DEBUG_MARK(mem));
+}
+
+
+/* put_block
+ * 
+ * does the work of free.
+ */
+ 
+static void put_block(void * mem_chunk)
+{
+    memory_block_header *h;
+#if SLAB_MAX > 0
+    slab *s;
+#endif
+    
+    if((char *)mem_chunk == NULL)//check if pointer != NULL
+        return;
+
+    //check if pointer between heap start and heap end.
+    if(((unsigned char *)mem_chunk < heap_start) || ((unsigned char *)mem_chunk > heap_end))
+    {
+#if MALLOC_DEBUG
+        debug_error(MALLOC_BAD_POINTER, mem_chunk);
+#endif
+        return;
+    }
+#if SLAB_MAX > 0
+    if(current_heap == &default_heap && (s = slab_of(mem_chunk)) != NULL)
+    {
+        slab_put(s, mem_chunk);
+        return;
+    }
+#endif
+#if MALLOC_DEBUG
+    if(!debug_check(mem_chunk))//leave a bad block alone
+        return;
+#endif
+        
+    h = BLOCK_HEADER(mem_chunk);   // Back up to the header itself
+    h->size &= ~BLOCK_CLEAN;//it has been used now
+#if MALLOC_DEBUG
+    {
+        unsigned int *word = (unsigned int *)mem_chunk;
+        
+        h->next = NULL;//no longer used, a second free will see that
+        while(word < (unsigned int *)BLOCK_NEXT(h))
+            *word++ = DEBUG_POISON;
+    }
+#endif
+#if MALLOC_OWNER
+    owner_untag(h);
+#endif
+#if MALLOC_BOUNDED > 0
+    if(RESERVE_BLOCK(h))
+    {
+        HEAP_LOCK();
+        reserve_put(h);
+        HEAP_UNLOCK();
+        return;
+    }
+#endif
+
+#if MALLOC_UCOS
+    if(magazine_put(h))
+        return;
+#endif
+
+    HEAP_LOCK();
+    engine_free(h);
+    HEAP_UNLOCK();
+}
+
+
+/* resize_block
+ *
+ * does the work of realloc.
+ */
+ 
+static void * resize_block(void * mem_chunk, unsigned int size)
+{
+    memory_block_header *h;
+    unsigned int *from;
+    unsigned int *to;
+    unsigned int words;
+    int resized;
+#if SLAB_MAX > 0
+    slab *s;
+#endif
+    void *mem;
+    
+    if((char *)mem_chunk == NULL)//nothing allocated yet
+        return get_block(size);
+    
+    if(size<1)//no memory asked, so give it all back
+    {
+        put_block(mem_chunk);
+        return NULL;
+    }
+    
+    //check if pointer between heap start and heap end.
+    if(((unsigned char *)mem_chunk < heap_start) || ((unsigned char *)mem_chunk > heap_end))
+    {
+#if MALLOC_DEBUG
+        debug_error(MALLOC_BAD_POINTER, mem_chunk);
+#endif
+        return NULL;
+    }
+#if SLAB_MAX > 0
+    s = slab_of(mem_chunk);
+    if(s != NULL)
+    {
+        if(size <= s->slot_size)//still fits its slot
+            return mem_chunk;
+        mem = get_block(size);
+        if(mem == NULL)
+            return NULL;
+        from = (unsigned int *)mem_chunk;
+        to = (unsigned int *)mem;
+        for(words = s->slot_size / sizeof(unsigned int); words > 0; words--)
+            *to++ = *from++;
+        slab_put(s, mem_chunk);
+        return mem;
+    }
+#endif
+#if MALLOC_DEBUG
+    if(!debug_check(mem_chunk))
+        return NULL;
+    if(size <= MAX_BLOCK_SIZE)
+        size += DEBUG_GUARD_SIZE;
+#endif
+    
+    size = ROUND_SIZE(size);
+    
+    h = BLOCK_HEADER(mem_chunk);   // Back up to the header itself
+    
+    HEAP_LOCK();
+#if MALLOC_BOUNDED > 0
+    if(RESERVE_BLOCK(h))//keeps its size, so it fits its class when freed
+        resized = (size <= BLOCK_SIZE(h));
+    else
+#endif
+    resized = heap_resize(h, size);
+    HEAP_UNLOCK();
+    if(resized)
+        return DEBUG_MARK(mem_chunk);//its guard word moved
+    
+#if MALLOC_DEBUG
+    size -= DEBUG_GUARD_SIZE;//get_block adds it again
+#endif
+    mem = get_block(size);//it has to move
+    if(mem == NULL)
+        return NULL;
+    
+    //blocks are a multiple of BLOCK_ALIGN, so copy whole words
+    from = (unsigned int *)mem_chunk;
+    to = (unsigned int *)mem;
+    words = BLOCK_SIZE(h) / sizeof(unsigned int);
+#if MALLOC_DEBUG
+    words--;//not the guard word, the new block has its own
+#endif
+    for(; words > 0; words--)
+        *to++ = *from++;
+    
+    put_block(mem_chunk);
+    return mem;
+}
+
+
+/* get_aligned_block
+ *
+ * does the work of memalign.
+ */
+ 
+static void * get_aligned_block(unsigned int align, unsigned int size)
+{
+    void *mem;
+    
+    if(((align & (align - 1)) != 0) || (align > MAX_BLOCK_SIZE))//not a power of two, or too large
+        return NULL;
+    if(align <= BLOCK_ALIGN)//every block is aligned like that
+        return get_block(size);
+    if(size<1)//no memory asked, so no pointer returned.
+        return NULL;
+#if MALLOC_DEBUG
+    if(size <= MAX_BLOCK_SIZE)
+        size += DEBUG_GUARD_SIZE;
+#endif
+    
+    size = ROUND_SIZE(size);
+    
+    HEAP_LOCK();
+#if MALLOC_BOUNDED > 0
+    fit_cut = 0;
+#endif
+#if !MALLOC_TLSF && MALLOC_STATS
+    call_visits = 0;
+#endif
+    mem = engine_memalign(size, align);
+#if !MALLOC_TLSF && MALLOC_STATS
+    if(call_visits > call_worst)
+        call_worst = call_visits;
+#endif
+#if MALLOC_BOUNDED > 0
+    if(mem == NULL)//the reserve is not aligned
+        MALLOC_ERROR = fit_cut ? MALLOC_TIME_BOUND : MALLOC_NO_MEMORY;
+#endif
+#if MALLOC_STATS
+    if(mem == NULL)
+        failed_count++;
+#endif
+    HEAP_UNLOCK();
+    return OWNER_TAG(DEBUG_MARK(mem));
+}
+
+
+#if MALLOC_TRACE
+/* trace_read
+ *
+ * call to take the oldest record from the trace. Returns 0 if there is none.
+ * If records were lost, a TRACE_LOST record with their number in 'size' comes
+ * first.
+ */
+
+int trace_read(trace_record *record)
+{
+    int found = 1;
+    
+    HEAP_LOCK();
+    if(trace_lost > 0)
+    {
+        record->op = TRACE_LOST;
+        record->prio = TRACE_NO_TASK;
+        record->tick = 0;
+        record->size = trace_lost;
+        record->addr = 0;
+        trace_lost = 0;
+    }
+    else if(trace_tail != trace_head)
+        *record = trace_buffer[trace_tail++ % TRACE_SIZE];
+    else
+        found = 0;
+    HEAP_UNLOCK();
+    return found;
+}
+#endif
+
+
+/* malloc_stats
+ *
+ * call to get the heap usage, see heap_stats. Copies the running counters, so
+ * this takes constant time.
+ */
+
+void malloc_stats(heap_stats *stats)
+{
+    HEAP_LOCK();
+    stats->heap_size = heap_end - heap_start;
+    stats->heap_peak = peak_end - heap_start;
+    stats->heap_room = heap_limit - heap_end;
+#if MALLOC_STATS
+    stats->free_bytes = free_size;
+    stats->free_blocks = free_count;
+    stats->cached_bytes = cached_size;
+    stats->used_bytes = stats->heap_size - free_size - cached_size;
+    stats->failed = failed_count;
+#else
+    stats->free_bytes = 0;
+    stats->free_blocks = 0;
+    stats->cached_bytes = 0;
+    stats->used_bytes = 0;
+    stats->failed = 0;
+#endif
+    HEAP_UNLOCK();
+}
+
+
+/* malloc_set_policy
+ *
+ * call to change how the first-fit engine picks a free block on the default
+ * heap, see MALLOC_FIT. Takes effect with the next malloc. A FIT_NEXT search
+ * starts where the last one of any policy left the rover.
+ *
+ * Returns the policy it had, or -1 if 'policy' is not known, or with TLSF.
+ */
+
+int malloc_set_policy(int policy)
+{
+#if MALLOC_TLSF
+    (void)policy;
+    return -1;
+#else
+    int old;
+    
+    if((policy < 0) || (policy >= FIT_COUNT))
+        return -1;
+    HEAP_LOCK();
+    old = fit_policy;
+    fit_policy = policy;
+    HEAP_UNLOCK();
+    return old;
+#endif
+}
+
+
+/* malloc_fit_stats
+ *
+ * call to get how many free blocks the searches of each fit policy looked at
+ * on the default heap, see fit_stats. All zero with TLSF, or without
+ * MALLOC_STATS.
+ */
+
+void malloc_fit_stats(fit_stats *stats)
+{
+    int i;
+    
+    HEAP_LOCK();
+    for(i = 0; i < FIT_COUNT; i++)
+    {
+#if !MALLOC_TLSF && MALLOC_STATS
+        stats->searches[i] = fit_searches[i];
+        stats->visits[i] = fit_visits[i];
+        stats->worst[i] = fit_worst[i];
+#else
+        stats->searches[i] = 0;
+        stats->visits[i] = 0;
+        stats->worst[i] = 0;
+#endif
+    }
+#if !MALLOC_TLSF && MALLOC_STATS
+    stats->worst_call = call_worst;
+#else
+    stats->worst_call = 0;
+#endif
+#if MALLOC_TLSF
+    stats->policy = -1;
+#else
+    stats->policy = fit_policy;
+#endif
+    HEAP_UNLOCK();
+}
+
+
+#if MALLOC_BOUNDED > 0
+/* malloc_error
+ *
+ * call to know why the last malloc of the calling task returned NULL, see
+ * malloc.h. Only meaningful after a call that failed.
+ */
+
+int malloc_error(void)
+{
+    return MALLOC_ERROR;
+}
+#endif
+
+
+#if WCET_SITES > 0
+/* malloc_wcet
+ *
+ * call to copy the sites in the table to 'sites', at most 'count' of them.
+ * Returns the number copied.
+ */
+
+unsigned int malloc_wcet(wcet_site *sites, unsigned int count)
+{
+    unsigned int i;
+    unsigned int n = 0;
+    
+    HEAP_LOCK();
+    for(i = 0; (i < WCET_SITES) && (n < count); i++)
+    {
+        if(wcet_table[i].site != NULL)
+            sites[n++] = wcet_table[i];
+    }
+    HEAP_UNLOCK();
+    return n;
+}
+#endif
+
+
+/* heap_walk_start
+ *
+ * call to start a walk over all blocks in the heap, with an empty summary. A
+ * walk that was still going is stopped, only one walk is kept up to date with
+ * the heap.
+ */
+
+void heap_walk_start(heap_walker *walker)
+{
+    int i;
+    
+    walker->used_bytes = 0;
+    walker->used_blocks = 0;
+    walker->free_bytes = 0;
+    walker->free_blocks = 0;
+    walker->largest_free = 0;
+    walker->fragmentation = 0;
+    for(i = 0; i < HEAP_HISTOGRAM; i++)
+        walker->histogram[i] = 0;
+    
+    HEAP_LOCK();
+    if(active_walker != NULL)
+        active_walker->next = NULL;
+    walker->next = heap_start;
+    active_walker = walker;
+    HEAP_UNLOCK();
+}
+
+
+/* heap_walk
+ *
+ * call to get the next block of a walk in 'block'. Returns 0 when the walk is
+ * done. The heap is locked for one block only, so the heap may change between
+ * calls; blocks merged or split since then may be counted twice or not at all.
+ */
+
+int heap_walk(heap_walker *walker, heap_block *block)
+{
+    int more;
+    
+    HEAP_LOCK();
+    more = walk_block(walker, block);
+    HEAP_UNLOCK();
+    return more;
+}
+
+
+/* heap_walk_stop
+ *
+ * call to end a walk before it is done, so the heap no longer keeps it up to
+ * date. Needed when the walker goes out of scope.
+ */
+
+void heap_walk_stop(heap_walker *walker)
+{
+    HEAP_LOCK();
+    if(active_walker == walker)
+        active_walker = NULL;
+    walker->next = NULL;
+    HEAP_UNLOCK();
+}
+
+
+/* heap_walk_steps
+ *
+ * call to walk on for at most 'steps' blocks, for the summary only. Returns 0
+ * when the walk is done.
+ */
+
+int heap_walk_steps(heap_walker *walker, unsigned int steps)
+{
+    heap_block block;
+    int more = 1;
+    
+    HEAP_LOCK();
+    while((steps-- > 0) && more)
+        more = walk_block(walker, &block);
+    HEAP_UNLOCK();
+    return more;
+}
+
+
+#if MALLOC_DEBUG
+/* set_malloc_hook
+ *
+ * call to have errors found by MALLOC_DEBUG reported to 'hook'.
+ */
+
+void set_malloc_hook(void (*hook)(int error, void *mem))
+{
+    debug_hook = hook;
+}
+#endif
+
+
+/* flush_magazine
+ *
+ * gives the blocks in the magazine of the calling task back to the heap. Only
+ * does something with MALLOC_UCOS.
+ */
+
+void flush_magazine(void)
+{
+#if MALLOC_UCOS
+    if(OSRunning)
+        drain_magazine(&magazines[OSPrioCur]);
+#endif
+}
+
+
+/* free_all_for_task
+ *
+ * call to free every block that task 'prio'(or OS_PRIO_SELF) allocated and
+ * did not free yet, and to empty its magazine. Only the list of that task is
+ * walked, and the heap is locked for one block at a time. The blocks freed
+ * by interrupts are given back before each block is taken, so none is freed
+ * twice, see owner_take(). Only does something with MALLOC_OWNER.
+ *
+ * Returns the number of blocks freed.
+ */
+
+int free_all_for_task(unsigned int prio)
+{
+#if MALLOC_OWNER
+    memory_block_header *h;
+    int count = 0;
+    
+    if(prio == OS_PRIO_SELF)
+        prio = OSPrioCur;
+    if(prio > OS_LOWEST_PRIO)
+        return 0;
+    
+    for(;;)
+    {
+        HEAP_LOCK();
+        h = owner_take(prio);
+        HEAP_UNLOCK();
+        if(h == NULL)
+            break;
+        TRACE(TRACE_FREE, 0, BLOCK_DATA(h));
+        put_block(BLOCK_DATA(h));
+        count++;
+    }
+    drain_magazine(&magazines[prio]);
+    return count;
+#else
+    (void)prio;
+    return 0;
+#endif
+}
+
+
+/* malloc_set_owner
+ *
+ * call to hand the block of 'mem' to task 'prio'(or OS_PRIO_SELF). It is taken
+ * off the list of the task that allocated it, and put on the list of 'prio'.
+ * Only does something with MALLOC_OWNER.
+ */
+
+void malloc_set_owner(void *mem, unsigned int prio)
+{
+#if MALLOC_OWNER
+    memory_block_header *h;
+    
+    if(prio == OS_PRIO_SELF)
+        prio = OSPrioCur;
+    if((mem == NULL) || (prio > OS_LOWEST_PRIO))
+        return;
+#if MALLOC_DEBUG
+    if(!debug_check(mem))//leave a bad block alone
+        return;
+#endif
+    
+    h = BLOCK_HEADER(mem);
+    HEAP_LOCK();
+    owner_untag(h);
+    owner_put(h, prio);
+    HEAP_UNLOCK();
+#else
+    (void)mem;
+    (void)prio;
+#endif
+}
+
+
+#if MALLOC_ISR
+/* malloc_from_isr
+ *
+ * call to allocate a block of at most ISR_POOL_SIZE bytes from an interrupt.
+ * Pops a block from the pool, with the interrupts masked for that only, so
+ * it never waits for the heap. Returns NULL if the pool is empty, or the
+ * block asked is too large.
+ */
+
+void * malloc_from_isr(unsigned int size)
+{
+#if ISR_POOL_COUNT > 0
+    void *mem;
+    ISR_STATE
+    
+    if((size < 1) || (size > ISR_POOL_SIZE))
+        return NULL;
+    
+    ISR_LOCK();
+    mem = isr_pool;
+    if(mem != NULL)
+    {
+        isr_pool = *(void **)mem;
+        isr_pool_count--;
+    }
+    ISR_UNLOCK();
+    return mem;
+#else
+    (void)size;
+    return NULL;
+#endif
+}
+
+
+/* free_from_isr
+ *
+ * call to free a block from an interrupt. A block of the size of the pool
+ * goes back in the pool, as long as it holds less than twice ISR_POOL_COUNT.
+ * Other blocks are pushed on a list, linked by their first word. Both with
+ * the interrupts masked for that only. The next malloc() or free() of a
+ * task gives the blocks on the list back to the heap, FIT_LIMIT at most, and
+ * flush_isr_frees() all of them. They are checked as free() does. With MALLOC_OWNER, a block that a task
+ * owns always goes on the list, so it is taken off the list of its owner
+ * under the heap lock, and free_all_for_task() can not free it again. A
+ * block that free_all_for_task() is freeing is left to it.
+ */
+
+void free_from_isr(void * mem_chunk)
+{
+    ISR_STATE
+    
+    if(((unsigned long)mem_chunk & (BLOCK_ALIGN - 1)) != 0)//never from malloc
+        return;
+    if(mem_chunk == NULL)
+        return;
+    
+    ISR_LOCK();//an interrupt of a higher priority may push one as well
+#if MALLOC_OWNER
+    if(OWNER_TAKEN(BLOCK_HEADER(mem_chunk)))//free_all_for_task frees it allready
+    {
+        ISR_UNLOCK();
+        return;
+    }
+#endif
+#if ISR_POOL_COUNT > 0
+#if SLAB_MAX > 0
+    if((slab_of(mem_chunk) == NULL) &&//a slab object has no header
+       (BLOCK_SIZE(BLOCK_HEADER(mem_chunk)) == ISR_POOL_BLOCK) &&
+       (isr_pool_count < 2 * ISR_POOL_COUNT))
+#elif MALLOC_OWNER
+    if((BLOCK_HEADER(mem_chunk)->owner_prev == NULL) &&//one of a task must come off its list
+       (BLOCK_SIZE(BLOCK_HEADER(mem_chunk)) == ISR_POOL_BLOCK) &&
+       (isr_pool_count < 2 * ISR_POOL_COUNT))
+#else
+    if((BLOCK_SIZE(BLOCK_HEADER(mem_chunk)) == ISR_POOL_BLOCK) &&
+       (isr_pool_count < 2 * ISR_POOL_COUNT))
+#endif
+    {
+        *(void **)mem_chunk = isr_pool;
+        isr_pool = mem_chunk;
+        isr_pool_count++;
+    }
+    else
+#endif
+    {
+        *(void **)mem_chunk = isr_frees;
+        isr_frees = mem_chunk;
+    }
+    ISR_UNLOCK();
+}
+
+
+/* flush_isr_frees
+ *
+ * call to give the blocks freed by interrupts back to the heap, and to bring
+ * the pool of malloc_from_isr back to ISR_POOL_COUNT blocks, from a task. The
+ * idle task hook is a good place, so the blocks do not wait for the next
+ * malloc() or free(), and the pool is full again before the next burst of
+ * interrupts.
+ */
+
+void flush_isr_frees(void)
+{
+    drain_isr_frees(~0U);//all of them
+#if ISR_POOL_COUNT > 0
+    if(isr_pool_count != ISR_POOL_COUNT)
+        fill_isr_pool();
+#endif
+}
+#endif
+
+
+/* init_stack_pool
+ *
+ * call to carve a pool of 'count' task stacks of 'size' bytes from the heap.
+ * The whole pool is one heap block, so the stacks have no header of their own
+ * and are never split up by other allocations. If the heap can not hold them
+ * all, the pool gets as many as fit.
+ *
+ * Returns the number of stacks in the pool, 0 if there is no memory at all.
+ */
+
+int init_stack_pool(stack_pool *pool, unsigned int size, unsigned int count)
+{
+    unsigned char *mem = NULL;
+    unsigned int i;
+    
+    //keep every stack aligned, and able to hold the link
+    size = (ROUND_SIZE(size) + BLOCK_ALIGN - 1) & ~(BLOCK_ALIGN - 1);
+    
+    HEAP_LOCK();
+    for(; count > 0; count--)//as many as fit
+    {
+        mem = engine_malloc(ROUND_SIZE(size * count));//the block may end a bit after the stacks
+        if(mem != NULL)
+            break;
+    }
+    HEAP_UNLOCK();
+    
+    pool->stacks = NULL;
+    pool->size = size;
+    pool->start = mem;
+    pool->end = mem + size * count;
+    
+    for(i = count; i > 0; i--)//link them, lowest address first
+    {
+        *(void **)(mem + size * (i - 1)) = pool->stacks;
+        pool->stacks = mem + size * (i - 1);
+    }
+    return count;
+}
+
+
+/* get_stack
+ *
+ * call to take a stack from the pool, in constant time. Returns a pointer to
+ * the lowest address of the stack, or NULL if all stacks are in use.
+ */
+
+void * get_stack(stack_pool *pool)
+{
+    void *stack;
+    
+    HEAP_LOCK();
+    stack = pool->stacks;
+    if(stack != NULL)
+        pool->stacks = *(void **)stack;//pop it
+    HEAP_UNLOCK();
+    return stack;
+}
+
+
+/* put_stack
+ *
+ * call to give a stack back to the pool, in constant time. Stacks that are not
+ * from this pool are ignored.
+ */
+
+void put_stack(stack_pool *pool, void *stack)
+{
+    //check if the stack is one of the pool
+    if(((unsigned char *)stack < pool->start) || ((unsigned char *)stack >= pool->end) ||
+       (((unsigned char *)stack - pool->start) % pool->size) != 0)
+        return;
+    
+    HEAP_LOCK();
+    *(void **)stack = pool->stacks;
+    pool->stacks = stack;
+    HEAP_UNLOCK();
+}
+
+
+/* shrink_stack
+ *
+ * call to give the low end of a stack that was allocated with malloc back to
+ * the heap, keeping the 'size' bytes at its top, where a stack that grows down
+ * starts. The low end becomes a free block in front of it, merged with the
+ * free block before it, if any. Nothing is given back if the low end can not
+ * hold a block of its own.
+ *
+ * Returns the new lowest address of the stack, or 'stack' if it stayed.
+ */
+
+void * shrink_stack(void * stack, unsigned int size)
+{
+    memory_block_header *h;
+    memory_block_header *n;
+    unsigned char *mem = stack;
+    
+    if((char *)stack == NULL)
+        return NULL;
+    
+    //check if pointer between heap start and heap end.
+    if(((unsigned char *)stack < heap_start) || ((unsigned char *)stack > heap_end))
+    {
+#if MALLOC_DEBUG
+        debug_error(MALLOC_BAD_POINTER, stack);
+#endif
+        return stack;
+    }
+#if SLAB_MAX > 0
+    if(slab_of(stack) != NULL)//too small to be a stack
+        return stack;
+#endif
+#if MALLOC_BOUNDED > 0
+    if(RESERVE_BLOCK(BLOCK_HEADER(stack)))
+        return stack;
+#endif
+#if MALLOC_DEBUG
+    if(!debug_check(stack))
+        return stack;
+    if(size <= MAX_BLOCK_SIZE)//the guard word stays at the top
+        size += DEBUG_GUARD_SIZE;
+#endif
+    
+    size = ROUND_SIZE(size);//so the top part starts aligned
+    
+    h = BLOCK_HEADER(stack);
+    
+    HEAP_LOCK();
+    if(BLOCK_SIZE(h) >= size + HEADER_SIZE + MIN_BLOCK_SIZE)
+    {
+        mem = (unsigned char *)BLOCK_NEXT(h) - size;
+        n = BLOCK_HEADER(mem);
+        n->size = SIZE_WORD(size);//the block in front of it is used, for now
+#if MALLOC_OWNER
+        n->owner_next = h->owner_next;//it takes the place of h on the list of its owner
+        n->owner_prev = h->owner_prev;
+        if(n->owner_prev != NULL)
+        {
+            n->owner_prev->owner_next = n;
+            if(n->owner_next != NULL)
+                n->owner_next->owner_prev = n;
+        }
+#endif
+        h->size = SIZE_WORD((unsigned char *)n - (unsigned char *)BLOCK_DATA(h)) | (h->size & BLOCK_PREV_FREE);
+        FREE_BLOCK_RELEASE(h);
+    }
+    HEAP_UNLOCK();
+    
+    if(mem == stack)
+        return stack;
+    TRACE(TRACE_ARG, 0, stack);//as a realloc that moved it
+    TRACE(TRACE_REALLOC, size, mem);
+    return DEBUG_MARK(mem);
+}
+
+
+/* init_arena
+ *
+ * call to take a chunk of 'size' bytes from the heap for an arena. Returns 0
+ * if there is no memory available anymore, the arena is then empty, and
+ * arena_alloc always fails.
+ */
+
+int init_arena(arena *a, unsigned int size)
+{
+    size = ROUND_SIZE(size) + SIZE_BIAS;//keep the pieces aligned, the block may be larger
+    a->start = get_block(size);
+    a->next = a->start;
+    a->end = (a->start == NULL) ? NULL : a->start + size;
+    return a->start != NULL;
+}
+
+
+/* arena_alloc
+ *
+ * call to take 'size' bytes from an arena, by moving its pointer up. The
+ * pieces have no header, and are rounded up to BLOCK_ALIGN, so the next one
+ * is aligned too. Returns NULL if the arena is full.
+ */
+
+void * arena_alloc(arena *a, unsigned int size)
+{
+    unsigned char *mem = a->next;
+    
+    //the room left is a multiple of BLOCK_ALIGN, so the rounding still fits
+    if((size < 1) || (size > (unsigned int)(a->end - a->next)))
+        return NULL;
+    a->next += (size + (BLOCK_ALIGN - 1)) & ~(BLOCK_ALIGN - 1);
+    return mem;
+}
+
+
+/* arena_mark
+ *
+ * call to get the spot an arena is at, for arena_release.
+ */
+
+void * arena_mark(arena *a)
+{
+    return a->next;
+}
+
+
+/* arena_release
+ *
+ * call to give back all pieces taken from an arena since 'mark' was taken.
+ * Marks that are not in the used part of the arena are ignored. With
+ * MALLOC_DEBUG, the pieces are filled with DEBUG_POISON.
+ */
+
+void arena_release(arena *a, void *mark)
+{
+    if(((unsigned char *)mark < a->start) || ((unsigned char *)mark > a->next))
+        return;
+#if MALLOC_DEBUG
+    {
+        unsigned int *word = (unsigned int *)mark;
+        
+        while(word < (unsigned int *)a->next)
+            *word++ = DEBUG_POISON;
+    }
+#endif
+    a->next = mark;
+}
+
+
+/* arena_reset
+ *
+ * call to give back all pieces of an arena at once. The chunk stays with the
+ * arena.
+ */
+
+void arena_reset(arena *a)
+{
+    arena_release(a, a->start);
+}
+
+
+/* free_arena
+ *
+ * call to give the chunk of an arena back to the heap. The arena is empty
+ * afterwards.
+ */
+
+void free_arena(arena *a)
+{
+    put_block(a->start);
+    a->start = NULL;
+    a->next = NULL;
+    a->end = NULL;
+}
+
+
+/*
+ * Local function implementations
+ */
+
+/* heap_reset
+ *
+ * starts current_heap as an empty heap, that may grow from 'start' up to
+ * 'limit'. With CALLOC_ZERO_HEAP, the memory must be zero allready.
+ */
+
+static void heap_reset(unsigned char *start, unsigned char *limit)
+{
+    start += ALIGN_PAD(start + HEADER_SIZE, BLOCK_ALIGN);//so the first block is aligned
+    heap_start = start;
+    heap_end = start;
+    heap_top = start;
+    heap_limit = limit;
+    peak_end = start;
+#if MALLOC_STATS
+    free_size = 0;
+    free_count = 0;
+    cached_size = 0;
+    failed_count = 0;
+#endif
+    active_walker = NULL;
+#if CALLOC_ZERO_HEAP
+    heap_clean = start;
+    clean_end = limit;
+#endif
+#if MALLOC_TLSF
+    {
+        int fl, sl;
+        tlsf_fl_bitmap = 0;
+        for(fl = 0; fl < TLSF_FL_COUNT; fl++)
+        {
+            tlsf_sl_bitmap[fl] = 0;
+            for(sl = 0; sl < TLSF_SL_COUNT; sl++)
+                tlsf_blocks[fl][sl] = NULL;
+        }
+    }
+#else
+    free_memory_blocks = NULL;
+    free_memory_tail = NULL;
+    free_rover = NULL;
+    fit_policy = MALLOC_FIT;
+#if MALLOC_STATS
+    {
+        int i;
+        for(i = 0; i < FIT_COUNT; i++)
+        {
+            fit_searches[i] = 0;
+            fit_visits[i] = 0;
+            fit_worst[i] = 0;
+        }
+        call_worst = 0;
+    }
+#endif
+#endif
+#if QUICK_LIST_MAX > 0
+    {
+        int i;
+        for(i = 0; i < QUICK_LIST_COUNT; i++)
+            quick_lists[i] = NULL;
+    }
+#endif
+}
+
+
+#if MALLOC_ISR
+/* drain_isr_frees
+ *
+ * gives up to 'count' blocks freed by interrupts back to the heap, all under
+ * one lock. The list is taken as a whole with the interrupts masked, so they
+ * can start a new one meanwhile. What is left of it waits in isr_taken for
+ * the next call, and is given back before a new list is taken. Every block
+ * is traced as a free of its own.
+ */
+
+static void drain_isr_frees(unsigned int count)
+{
+    void *mem;
+    ISR_STATE
+    
+    HEAP_LOCK();
+    for(; count > 0; count--)
+    {
+        if(isr_taken == NULL)//take the ones freed since
+        {
+            ISR_LOCK();
+            isr_taken = isr_frees;
+            isr_frees = NULL;
+            ISR_UNLOCK();
+            if(isr_taken == NULL)
+                break;
+        }
+        mem = isr_taken;
+        isr_taken = *(void **)mem;
+        TRACE(TRACE_FREE, 0, mem);
+        put_block(mem);
+    }
+    HEAP_UNLOCK();
+}
+
+
+#if ISR_POOL_COUNT > 0
+/* fill_isr_pool
+ *
+ * brings the pool of malloc_from_isr back to ISR_POOL_COUNT blocks, taking
+ * blocks from the heap, or giving them back. The interrupts are only masked
+ * while a block is pushed or popped.
+ */
+
+static void fill_isr_pool(void)
+{
+    void *mem;
+    ISR_STATE
+    
+    while(isr_pool_count < ISR_POOL_COUNT)
+    {
+        mem = get_block(ISR_POOL_SIZE);
+        if(mem == NULL)
+            break;
+#if MALLOC_OWNER
+        owner_untag(BLOCK_HEADER(mem));//the pool belongs to no task
+#endif
+        ISR_LOCK();
+        *(void **)mem = isr_pool;
+        isr_pool = mem;
+        isr_pool_count++;
+        ISR_UNLOCK();
+    }
+    while(isr_pool_count > ISR_POOL_COUNT)
+    {
+        ISR_LOCK();
+        mem = isr_pool;
+        if(mem != NULL)
+        {
+            isr_pool = *(void **)mem;
+            isr_pool_count--;
+        }
+        ISR_UNLOCK();
+        put_block(mem);
+    }
+}
+#endif
+#endif
+
+
+#if MALLOC_TRACE
+/* trace_put
+ *
+ * adds a record to the trace, with the task priority and the time with
+ * MALLOC_UCOS. Addresses are stored as offset from 'end', so they fit in 32
+ * bits on the host as well.
+ */
+
+static void trace_put(unsigned char op, unsigned int size, void *mem)
+{
+    extern unsigned char   end asm ("end");// Defined by the linker. heap comes here after
+    trace_record *record;
+    
+    HEAP_LOCK();
+    if(trace_head - trace_tail >= TRACE_SIZE)//full
+    {
+        trace_lost++;
+        HEAP_UNLOCK();
+        return;
+    }
+    record = &trace_buffer[trace_head++ % TRACE_SIZE];
+    record->op = op;
+#if MALLOC_UCOS
+    record->prio = OSRunning ? OSPrioCur : TRACE_NO_TASK;
+    record->tick = (unsigned short)OSTimeGet();
+#else
+    record->prio = TRACE_NO_TASK;
+    record->tick = 0;
+#endif
+    record->size = size;
+    record->addr = (mem == NULL) ? 0 : (unsigned int)((unsigned char *)mem - &end);
+    HEAP_UNLOCK();
+}
+#endif
+
+
+#if WCET_SITES > 0
+/* wcet_put
+ *
+ * adds a call of 'ticks' long to its site in the table. The site is looked up
+ * from where its address hashes to, taking the first empty entry if it is
+ * not in the table yet. When the table is full, the call is not kept.
+ */
+
+static void wcet_put(unsigned char op, void *site, unsigned int ticks)
+{
+    wcet_site *w;
+    unsigned int i = ((unsigned long)site >> 1) % WCET_SITES;//thumb code is on halfwords
+    unsigned int n;
+    
+    HEAP_LOCK();
+    for(n = 0; n < WCET_SITES; n++)
+    {
+        w = &wcet_table[i];
+        if((w->site == site) || (w->site == NULL))
+        {
+            w->site = site;
+            w->op = op;
+            w->calls++;
+            if(ticks > w->worst)
+                w->worst = ticks;
+            break;
+        }
+        i = (i + 1) % WCET_SITES;
+    }
+    HEAP_UNLOCK();
+}
+#endif
+
+
+#if MALLOC_DEBUG
+/* debug_mark
+ *
+ * marks a block as handed out: the magic word in its header, and the guard
+ * word at its end. Returns 'mem', which may be NULL.
+ */
+
+static void * debug_mark(void *mem)
+{
+    memory_block_header *h = BLOCK_HEADER(mem);
+    
+    if(mem != NULL)
+    {
+        h->next = BLOCK_MAGIC(h);
+        BLOCK_GUARD(h) = DEBUG_GUARD;
+    }
+    return mem;
+}
+
+
+/* debug_check
+ *
+ * checks a block that is freed or reallocated. Returns 0, after reporting
+ * it, if the block is not handed out by malloc(or allready freed), or if the
+ * guard word after it was overwritten.
+ */
+
+static int debug_check(void *mem)
+{
+    memory_block_header *h = BLOCK_HEADER(mem);
+    
+    //the size is only valid once the magic word is found
+    if((((unsigned long)mem & (BLOCK_ALIGN - 1)) != 0) || (h->next != BLOCK_MAGIC(h)))
+    {
+        debug_error(MALLOC_BAD_BLOCK, mem);
+        return 0;
+    }
+    if(BLOCK_GUARD(h) != DEBUG_GUARD)
+    {
+        debug_error(MALLOC_OVERRUN, mem);
+        return 0;
+    }
+    return 1;
+}
+
+
+/* debug_error
+ *
+ * reports an error to the hook, if there is one.
+ */
+
+static void debug_error(int error, void *mem)
+{
+    if(debug_hook != NULL)
+        debug_hook(error, mem);
+}
+#endif
+
+
+/* walk_block
+ *
+ * takes the next block of a heap walk, and adds it to its summary. The walk
+ * ends at heap_end, and is then taken off active_walker, so a heap that grows
+ * afterwards is not walked into. The heap must be locked. Returns 0 if the
+ * walk is done.
+ */
+
+static int walk_block(heap_walker *walker, heap_block *block)
+{
+    memory_block_header *h;
+    unsigned int size;
+    int i;
+    
+    block->mem = NULL;
+    block->size = 0;
+    block->free = 0;
+    if((walker->next == NULL) || (walker->next >= heap_end))
+    {
+        if(active_walker == walker)
+            active_walker = NULL;
+        walker->next = NULL;
+        return 0;
+    }
+    
+    h = (memory_block_header *)walker->next;
+    size = BLOCK_SIZE(h);
+    block->mem = BLOCK_DATA(h);
+    block->size = size;
+    block->free = (h->size & BLOCK_FREE) ? 1 : 0;
+    
+    if(block->free)
+    {
+        walker->free_bytes += size;
+        walker->free_blocks++;
+        if(size > walker->largest_free)
+            walker->largest_free = size;
+        for(i = 0; (i < HEAP_HISTOGRAM - 1) && (((unsigned int)BLOCK_ALIGN << (i + 1)) <= size); i++)
+            ;//size class: BLOCK_ALIGN << i up to twice that
+        walker->histogram[i]++;
+        //the part of the free memory that is not in the largest block(the
+        //product fits in 32 bits for heaps up to 40 MB)
+        walker->fragmentation = 100 - (walker->largest_free * 100) / walker->free_bytes;
+    }
+    else
+    {
+        walker->used_bytes += size;
+        walker->used_blocks++;
+    }
+    
+    walker->next = (unsigned char *)BLOCK_NEXT(h);
+    if(walker->next >= heap_end)//last block, done before the heap grows past it
+    {
+        if(active_walker == walker)
+            active_walker = NULL;
+        walker->next = NULL;
+    }
+    return 1;
+}
+
+
+/* heap_resize
+ *
+ * resizes a used block to 'size' bytes(allready aligned) without moving it.
+ * A block shrinks by splitting off its tail, and grows by taking in the free
+ * block after it, or by growing the heap if it is the last block in heap.
+ * Returns 0 if it can not grow where it is.
+ */
+
+static int heap_resize(memory_block_header *h, unsigned int size)
+{
+    memory_block_header *n;
+    
+    if(BLOCK_SIZE(h) >= size)//shrink, or stay as it is
+    {
+        split_block(h, size);
+        return 1;
+    }
+    
+    n = BLOCK_NEXT(h);
+    if((unsigned char *)n >= heap_end)//last block in heap, grow the heap
+    {
+        if(_sbrk(size - BLOCK_SIZE(h)) == (volatile unsigned char *)-1)
+            return 0;
+        h->size += size - BLOCK_SIZE(h);
+        return 1;
+    }
+    
+    //take in the free block after it, it is never the last in heap
+    if((n->size & BLOCK_FREE) && (BLOCK_SIZE(h) + HEADER_SIZE + BLOCK_SIZE(n) >= size))
+    {
+        FREE_BLOCK_REMOVE(n);
+        WALKER_MOVE(n, h);
+        h->size += BLOCK_SIZE(n) + HEADER_SIZE;
+        BLOCK_NEXT(h)->size &= ~BLOCK_PREV_FREE;
+        split_block(h, size);
+        return 1;
+    }
+    return 0;
+}
+
+
+/* split_block
+ *
+ * cuts a used block down to 'size' bytes, and gives the rest back to the heap
+ * if it is large enough to be a block of its own.
+ */
+
+static void split_block(memory_block_header *h, unsigned int size)
+{
+    memory_block_header *rest;
+    
+    if(BLOCK_SIZE(h) < (size + HEADER_SIZE + SPLIT_MIN))
+        return;//rest is too small, keep it in the block
+    
+    rest = (memory_block_header *)((char *)BLOCK_DATA(h) + size);
+    rest->size = SIZE_WORD(BLOCK_SIZE(h) - size - HEADER_SIZE);//the block in front of it is used
+    h->size = SIZE_WORD(size) | (h->size & BLOCK_PREV_FREE);
+    FREE_BLOCK_RELEASE(rest);//merge it, a quick list would keep it apart
+}
+
+
+/* heap_grow
+ *
+ * claims a new block of 'size' bytes at the end of the heap. Returns NULL if
+ * there is no memory available anymore. The block is marked clean if the heap
+ * never was this large before.
+ */
+
+static memory_block_header * heap_grow(unsigned int size)
+{
+    memory_block_header *h;
+#if CALLOC_ZERO_HEAP
+    int clean = (heap_end >= heap_clean) &&
+                (heap_end + HEADER_SIZE + size <= clean_end);
+#endif
+    
+    h = (memory_block_header *)_sbrk(HEADER_SIZE + size);
+    if (h == (memory_block_header *)-1) // no memory availible
+        return NULL;
+    
+    h->size = SIZE_WORD(size);//the block in front of it is never free, see release_block()
+    h->next = NULL;
+#if CALLOC_ZERO_HEAP
+    if(clean)
+        h->size |= BLOCK_CLEAN;
+#endif
+    return h;
+}
+
+
+/* engine_memalign
+ *
+ * takes an 'align' aligned block of 'size' bytes(allready aligned) from the
+ * heap. Searches the free list for a block that holds it at an aligned spot,
+ * or with TLSF (or if none does) takes a block large enough to hold it
+ * anywhere. Returns NULL if there is no memory available anymore.
+ */
+
+static void * engine_memalign(unsigned int size, unsigned int align)
+{
+    memory_block_header *h = NULL;
+    void *mem;
+    
+#if !MALLOC_TLSF
+    h = aligned_fit(size, align);
+#endif
+    if(h == NULL)//take one that fits it at any alignment, with room for the slack
+    {
+        mem = engine_malloc(size + align + HEADER_SIZE + MIN_BLOCK_SIZE);
+        if(mem != NULL)
+            h = BLOCK_HEADER(mem);
+    }
+    return (h == NULL) ? NULL : align_block(h, size, align);
+}
+
+
+/* align_block
+ *
+ * cuts an 'align' aligned block of 'size' bytes out of a used block, and gives
+ * the slack in front of and after it back to the heap. Slack in front must be
+ * able to hold a block of its own, so the aligned spot is moved up until it
+ * does. The used block must be large enough for that.
+ */
+
+static void * align_block(memory_block_header *h, unsigned int size, unsigned int align)
+{
+    memory_block_header *n;
+    char *mem = (char *)BLOCK_DATA(h);
+    
+    if(ALIGN_PAD(mem, align) != 0)//cut off the slack in front
+    {
+        mem += HEADER_SIZE + MIN_BLOCK_SIZE;
+        mem += ALIGN_PAD(mem, align);
+        n = BLOCK_HEADER(mem);
+        n->size = SIZE_WORD((char *)BLOCK_NEXT(h) - mem);//the block in front of it is used, for now
+        h->size = SIZE_WORD((char *)n - (char *)BLOCK_DATA(h)) | (h->size & BLOCK_PREV_FREE);
+        FREE_BLOCK_RELEASE(h);
+        h = n;
+    }
+    split_block(h, size);//and the slack after it
+    return BLOCK_DATA(h);
+}
+
+
+/* zero_words
+ *
+ * clears 'size' bytes(a multiple of the word size) at 'mem'. Four words per
+ * step, so the compiler can use a multi-register store.
+ */
+
+static void zero_words(void *mem, unsigned int size)
+{
+    unsigned int *to = (unsigned int *)mem;
+    unsigned int words = size / sizeof(unsigned int);
+    
+    for(; words >= 4; words -= 4)
+    {
+        to[0] = 0;
+        to[1] = 0;
+        to[2] = 0;
+        to[3] = 0;
+        to += 4;
+    }
+    for(; words > 0; words--)
+        *to++ = 0;
+}
+
+
+#if MALLOC_UCOS
+/* magazine_get
+ *
+ * takes a block of 'size' bytes from the magazine of the running task.
+ * Returns NULL if it has none. Only the running task uses its magazine, so
+ * no lock is needed.
+ */
+
+static void * magazine_get(unsigned int size)
+{
+    magazine *m;
+    memory_block_header *h;
+    memory_block_header *previous = NULL;
+    
+    if(!OSRunning || size > MAGAZINE_MAX || current_heap != &default_heap)//no tasks yet, or never kept
+        return NULL;
+    
+    m = &magazines[OSPrioCur];
+    for(h = m->blocks; h != NULL; h = h->next)
+    {
+        if(BLOCK_SIZE(h) == size)
+        {
+            if(previous == NULL)
+                m->blocks = h->next;
+            else
+                previous->next = h->next;
+            m->count--;
+            return BLOCK_DATA(h);
+        }
+        previous = h;
+    }
+    return NULL;
+}
+
+
+/* magazine_put
+ *
+ * puts a block in the magazine of the running task, emptying it first if it
+ * is full. Returns 0 if the block should go back to the heap instead. The
+ * last block in heap always goes back, so the heap can shrink.
+ */
+
+static int magazine_put(memory_block_header *h)
+{
+    magazine *m;
+    
+    if(!OSRunning || BLOCK_SIZE(h) > MAGAZINE_MAX || (unsigned char *)BLOCK_NEXT(h) >= heap_end ||
+       current_heap != &default_heap)
+        return 0;
+    
+    m = &magazines[OSPrioCur];
+    if(m->count >= MAGAZINE_SIZE)
+        drain_magazine(m);
+    h->next = m->blocks;//not marked free, so its neighbours will not merge with it
+    m->blocks = h;
+    m->count++;
+    return 1;
+}
+
+
+/* drain_magazine
+ *
+ * gives all blocks in a magazine back to the heap, taking the lock only once.
+ */
+
+static void drain_magazine(magazine *m)
+{
+    memory_block_header *h;
+    
+    HEAP_LOCK();
+    while((h = m->blocks) != NULL)
+    {
+        m->blocks = h->next;
+        engine_free(h);
+    }
+    m->count = 0;
+    HEAP_UNLOCK();
+}
+#endif
+
+
+#if MALLOC_OWNER
+/* owner_tag
+ *
+ * puts the block of 'mem' in front of the list of the running task, and
+ * returns 'mem'. The 'owner_prev' of the first block on a list is the list
+ * itself, seen as a header(owner_next is its first member), so a block can be
+ * taken off without knowing its owner. A block without an owner gets NULL.
+ */
+
+static void * owner_tag(void *mem)
+{
+    memory_block_header *h;
+    
+    if(mem == NULL)
+        return NULL;
+    
+    h = BLOCK_HEADER(mem);
+    h->owner_next = NULL;
+    h->owner_prev = NULL;
+    if(!OSRunning || current_heap != &default_heap)//no tasks yet, or another heap
+        return mem;
+    
+    HEAP_LOCK();
+    owner_put(h, OSPrioCur);
+    HEAP_UNLOCK();
+    return mem;
+}
+
+
+/* owner_put
+ *
+ * puts the block in front of the list of task 'prio'.
+ */
+
+static void owner_put(memory_block_header *h, unsigned int prio)
+{
+    memory_block_header **list = &owner_lists[prio];
+    
+    h->owner_next = *list;
+    h->owner_prev = OWNER_HEAD(list);
+    if(*list != NULL)
+        (*list)->owner_prev = h;
+    *list = h;
+}
+
+
+/* owner_untag
+ *
+ * takes a block off the list of its owner, if it has one. A block that
+ * free_all_for_task took keeps its mark.
+ */
+
+static void owner_untag(memory_block_header *h)
+{
+    HEAP_LOCK();
+    if((h->owner_prev != NULL) && !OWNER_TAKEN(h))
+    {
+        h->owner_prev->owner_next = h->owner_next;
+        if(h->owner_next != NULL)
+            h->owner_next->owner_prev = h->owner_prev;
+        h->owner_next = NULL;
+        h->owner_prev = NULL;
+    }
+    HEAP_UNLOCK();
+}
+
+
+/* owner_take
+ *
+ * takes the first block off the list of task 'prio', and marks it taken, see
+ * OWNER_TAKEN(). With MALLOC_ISR, the blocks freed by interrupts are given
+ * back first, and the interrupts stay masked from the check that none are
+ * left until the block is marked. So the block is not on the list of
+ * interrupt frees as well, and free_from_isr leaves it alone from then on.
+ */
+
+static memory_block_header * owner_take(unsigned int prio)
+{
+    memory_block_header *h;
+#if MALLOC_ISR
+    ISR_STATE
+    
+    ISR_LOCK();
+    while((isr_frees != NULL) || (isr_taken != NULL))//give all back, interrupts enabled
+    {
+        ISR_UNLOCK();
+        drain_isr_frees(~0U);
+        ISR_LOCK();
+    }
+#endif
+    h = owner_lists[prio];
+    if(h != NULL)
+    {
+        owner_untag(h);
+        h->owner_prev = h;//taken, until malloc hands it out again
+    }
+#if MALLOC_ISR
+    ISR_UNLOCK();
+#endif
+    return h;
+}
+#endif
+
+
+#if SLAB_MAX > 0
+/* slab_get
+ *
+ * takes an object of 'size' bytes from the first slab of its size with a
+ * free slot, the highest free bit of its bitmap. A slab that is full then is
+ * taken off the list. If there is no slab with a free slot, a new one is
+ * taken from the heap, aligned on SLAB_BYTES.
+ */
+
+static void * slab_get(unsigned int size)
+{
+    slab **list;
+    slab *s;
+    void *mem = NULL;
+    int slot;
+    int i;
+    
+    size = (size + BLOCK_ALIGN - 1) & ~(BLOCK_ALIGN - 1);
+    list = &slab_lists[size / BLOCK_ALIGN - 1];
+    
+    HEAP_LOCK();
+    s = *list;
+    if(s == NULL)
+    {
+        for(i = 0; i < SLAB_COUNT; i++)//a free entry for it
+        {
+            if(slabs[i] == NULL)
+                break;
+        }
+        if(i < SLAB_COUNT)
+            s = (slab *)engine_memalign(ROUND_SIZE(SLAB_BYTES), SLAB_BYTES);
+        if(s != NULL)
+        {
+            s->next = NULL;
+            s->free_map = SLAB_EMPTY(size);
+            s->slot_size = size;
+            s->index = i;
+            slabs[i] = s;
+            *list = s;
+            if(slab_low == NULL || s < slab_low)
+                slab_low = s;
+            if(s > slab_high)
+                slab_high = s;
+            STATS(cached_size += SLAB_SLOTS(size) * size);
+        }
+    }
+    if(s != NULL)
+    {
+        slot = fls_word(s->free_map);
+        s->free_map &= ~(1U << slot);
+        if(s->free_map == 0)//full
+            *list = s->next;
+        mem = (unsigned char *)s + SLAB_HEADER + slot * size;
+        STATS(cached_size -= size);
+    }
+    HEAP_UNLOCK();
+    return mem;
+}
+
+
+/* slab_put
+ *
+ * gives an object back to slab 's'. A slab that was full goes back on the
+ * list of its size, a slab that is empty now goes back to the heap. Pointers
+ * that are not on a slot, or to a free slot, are ignored.
+ */
+
+static void slab_put(slab *s, void *mem)
+{
+    unsigned int offset = (unsigned char *)mem - ((unsigned char *)s + SLAB_HEADER);
+    unsigned int size = s->slot_size;
+    unsigned int slot = offset / size;
+    slab **list = &slab_lists[size / BLOCK_ALIGN - 1];
+    
+    if((offset % size != 0) || (slot >= SLAB_SLOTS(size)))
+        return;
+    
+    HEAP_LOCK();
+    if(!(s->free_map & (1U << slot)))
+    {
+        if(s->free_map == 0)//was full
+        {
+            s->next = *list;
+            *list = s;
+        }
+        s->free_map |= 1U << slot;
+        STATS(cached_size += size);
+        if(s->free_map == SLAB_EMPTY(size))//empty, give it back
+        {
+            while(*list != s)
+                list = &(*list)->next;
+            *list = s->next;
+            slabs[s->index] = NULL;
+            STATS(cached_size -= SLAB_SLOTS(size) * size);
+            engine_free(BLOCK_HEADER(s));
+        }
+    }
+    HEAP_UNLOCK();
+}
+
+
+/* slab_of
+ *
+ * finds the slab from the address of an object. Every slab is on a multiple
+ * of SLAB_BYTES, so that is where its header would be. The header is only
+ * trusted if its entry in slabs[] points back at it, anything else could be
+ * the data of a used block. Needs no lock, as the slab of an object that is
+ * still in use stays where it is. Anything between slab_low and slab_high is
+ * heap memory(or was), so its header can be read.
+ */
+
+static slab * slab_of(void *mem)
+{
+    slab *s = (slab *)((unsigned long)mem & ~(unsigned long)(SLAB_BYTES - 1));
+    
+    if((s < slab_low) || (s > slab_high))
+        return NULL;
+    if((s->index >= SLAB_COUNT) || (slabs[s->index] != s))
+        return NULL;
+    if((unsigned char *)mem < (unsigned char *)s + SLAB_HEADER)
+        return NULL;
+    return s;
+}
+#endif
+
+
+#if MALLOC_BOUNDED > 0
+/* reserve_fill
+ *
+ * sets the blocks of the reserve apart, the smallest first. The heap is empty
+ * yet, so they lie next to each other from heap_start on, and a block of the
+ * reserve is known by its address.
+ */
+
+static void reserve_fill(void)
+{
+    void *mem;
+    int i;
+    int n;
+    
+    reserve_low = heap_end;
+    for(i = 0; i < RESERVE_CLASSES; i++)
+    {
+        reserve_lists[i] = NULL;
+        for(n = 0; n < RESERVE_COUNT; n++)
+        {
+            mem = engine_malloc(RESERVE_SIZE(i));
+            if(mem == NULL)//the heap is too small, keep what there is
+                break;
+            reserve_put(BLOCK_HEADER(mem));
+        }
+    }
+    reserve_high = heap_end;
+}
+
+
+/* reserve_get
+ *
+ * takes the first block from the smallest class that holds 'size' bytes and
+ * has one left. A reserve block is used as it is, never split.
+ */
+
+static void * reserve_get(unsigned int size)
+{
+    memory_block_header *h;
+    int i;
+    
+    for(i = 0; i < RESERVE_CLASSES; i++)
+    {
+        h = reserve_lists[i];
+        if((h != NULL) && (size <= RESERVE_SIZE(i)))
+        {
+            reserve_lists[i] = h->next;//pop it
+            STATS(cached_size -= BLOCK_BYTES(h));
+            return BLOCK_DATA(h);
+        }
+    }
+    return NULL;
+}
+
+
+/* reserve_put
+ *
+ * pushes a block on the list of its class. The block keeps its size while it
+ * is used, see resize_block(), so it allways matches one.
+ */
+
+static void reserve_put(memory_block_header *h)
+{
+    int i;
+    
+    for(i = 0; i < RESERVE_CLASSES; i++)
+    {
+        if(BLOCK_SIZE(h) == RESERVE_SIZE(i))
+        {
+            h->next = reserve_lists[i];
+            reserve_lists[i] = h;
+            STATS(cached_size += BLOCK_BYTES(h));
+            return;
+        }
+    }
+}
+#endif
+
+
+#if MALLOC_TLSF
+/* engine_malloc
+ *
+ * takes a block of 'size' bytes(allready aligned) from the heap, using the
+ * TLSF engine. Takes the first block from the smallest non-empty list that is
+ * guaranteed to fit, and splits off what is left. If nothing fits, the heap
+ * is grown. Returns NULL if there is no memory available anymore.
+ */
+ 
+static void * engine_malloc(unsigned int size)
+{
+    memory_block_header *h;
+    memory_block_header *rest;
+    
+    h = tlsf_find(size);
+    if(h == NULL)//nothing fits, new piece of mem
+    {
+        h = heap_grow(size);
+        if (h == NULL) // no memory availible
+            return NULL;
+        return BLOCK_DATA(h);
+    }
+    
+    //split off the rest, if it is large enough to be a block of its own
+    if(BLOCK_SIZE(h) >= (size + HEADER_SIZE + SPLIT_MIN))
+    {
+        rest = (memory_block_header *)((char *)BLOCK_DATA(h) + size);
+        rest->size = SIZE_WORD(BLOCK_SIZE(h) - size - HEADER_SIZE) | BLOCK_FREE;
+        h->size = SIZE_WORD(size) | (h->size & BLOCK_PREV_FREE);
+        BLOCK_PREV(BLOCK_NEXT(rest)) = rest;//block after it allready knows its front is free
+        tlsf_insert(rest);
+    }
+    else
+    {
+        h->size &= ~BLOCK_FREE;
+        if((unsigned char *)BLOCK_NEXT(h) < heap_end)
+            BLOCK_NEXT(h)->size &= ~BLOCK_PREV_FREE;
+    }
+    return BLOCK_DATA(h);// Address following h; is the actual block of data
+}
+
+
+/* engine_free
+ * 
+ * gives a block back to the heap, using the TLSF engine. Merges it with the
+ * blocks in front of and after it if these are free, and resizes the heap if
+ * memory is freed at the end of the heap. Takes constant time.
+ */
+ 
+static void engine_free(memory_block_header *h)
+{
+    memory_block_header *n;
+    
+    if(h->size & BLOCK_PREV_FREE)//merge with the free block in front of it
+    {
+        n = BLOCK_PREV(h);
+        tlsf_remove(n);
+        WALKER_MOVE(h, n);
+        n->size += BLOCK_SIZE(h) + HEADER_SIZE;
+        h = n;
+    }
+    
+    n = BLOCK_NEXT(h);
+    if((unsigned char *)n >= heap_end)//chunk is last in heap, give mem back to system.
+    {
+        _sbrk(0 - (BLOCK_SIZE(h) + HEADER_SIZE));
+        return;
+    }
+    
+    if(n->size & BLOCK_FREE)//merge with the free block after it
+    {
+        tlsf_remove(n);
+        WALKER_MOVE(n, h);
+        h->size += BLOCK_SIZE(n) + HEADER_SIZE;
+        n = BLOCK_NEXT(h);
+    }
+    
+    h->size |= BLOCK_FREE;
+    BLOCK_PREV(n) = h;//write the footer
+    n->size |= BLOCK_PREV_FREE;
+    tlsf_insert(h);
+}
+
+#else
+/* engine_malloc
+ *
+ * takes a block of 'size' bytes(allready aligned) from the heap. Small blocks
+ * (up to QUICK_LIST_MAX) are taken from the quick lists first, then the free
+ * list is searched first-fit. Returns NULL if there is no memory available
+ * anymore.
  */
-#include "malloc.h"
+ 
+static void * engine_malloc(unsigned int size)
+{
+    void *mem;
+
+#if QUICK_LIST_MAX > 0
+    if(size <= QUICK_LIST_MAX)//small block, try its quick list first
+    {
+        memory_block_header *h = quick_lists[QUICK_INDEX(size)];
+        
+        if(h != NULL)
+        {
+            quick_lists[QUICK_INDEX(size)] = h->next;//pop it
+            STATS(cached_size -= BLOCK_BYTES(h));
+            return BLOCK_DATA(h);
+        }
+    }
+#endif
 
+    mem = list_fit(size);
 
-// Structure that describes a block.
-typedef struct memory_block_header {
-    unsigned int                 size;//means that there is a max of 4 gigs per block
-    struct memory_block_header  *next;
-    /* Actual memory block starts here */
-} memory_block_header;
+#if QUICK_LIST_MAX > 0
+    //out of memory, but there may be mergeable blocks on the quick lists
+    if(mem == NULL && flush_quick_lists(FIT_LIMIT))
+        mem = list_fit(size);
+#endif
+    return mem;
+}
 
 
-/*
- * Global variabeles
- *
- * These variabeles are used by the functions to keep track of information as
- * where the stack begins, the heap ends, and where free memory is located. 
+/* engine_free
+ * 
+ * gives a block back to the heap. Small blocks are put on their quick list,
+ * unmerged, the others are merged into the free list by release_block().
  */
+ 
+static void engine_free(memory_block_header *h)
+{
+#if QUICK_LIST_MAX > 0
+    //small block, keep it for the next malloc of this size. Except when it is
+    //the last block in heap, that one is better given back to the system.
+    if((BLOCK_SIZE(h) <= QUICK_LIST_MAX) && ((unsigned char *)BLOCK_NEXT(h) < heap_end))
+    {//it is not marked free, so its neighbours will not merge with it
+        h->next = quick_lists[QUICK_INDEX(BLOCK_SIZE(h))];
+        quick_lists[QUICK_INDEX(BLOCK_SIZE(h))] = h;
+        STATS(cached_size += BLOCK_BYTES(h));
+        return;
+    }
+#endif
 
-memory_block_header *free_memory_blocks;//this is the pointer to the start of the free list
+    release_block(h);
+}
 
-unsigned char * global_stack_ptr;//global pointer to maximum heap size
-unsigned char * heap_end;//global pointer to current heap size
 
+#endif
 
-/*
- * Local function prototypes
+
+#if MALLOC_TLSF || (SLAB_MAX > 0)
+/* fls_word
  *
- * These functions may be acessible from the outside, as they can break stuff.
+ * returns the number of the highest bit set in 'word', or -1 if it is 0.
+ * The ARM7TDMI has no clz instruction, older compilers get a binary search.
  */
 
-/* _sbrk
+static int fls_word(unsigned int word)
+{
+#if (__GNUC__ > 3) || ((__GNUC__ == 3) && (__GNUC_MINOR__ >= 4))
+    return word ? (31 - __builtin_clz(word)) : -1;
+#else
+    int bit = 31;
+
+    if(word == 0)
+        return -1;
+    if(!(word & 0xffff0000)) { word <<= 16; bit -= 16; }
+    if(!(word & 0xff000000)) { word <<= 8;  bit -= 8; }
+    if(!(word & 0xf0000000)) { word <<= 4;  bit -= 4; }
+    if(!(word & 0xc0000000)) { word <<= 2;  bit -= 2; }
+    if(!(word & 0x80000000)) { bit -= 1; }
+    return bit;
+#endif
+}
+#endif
+
+
+#if MALLOC_TLSF
+/* tlsf_mapping
  *
- * function that actually claims/releases a piece of memory between _end and stack.
- * partly copied from the libgloss library(arm port)
+ * calculates the first and second level list a block of 'size' bytes is kept on.
  */
-volatile unsigned char * _sbrk (int incr);
 
+static void tlsf_mapping(unsigned int size, int *fl, int *sl)
+{
+    int t;
+    
+    if(size < TLSF_SMALL_BLOCK)//small blocks have a list per BLOCK_ALIGN step
+    {
+        *fl = 0;
+        *sl = size / BLOCK_ALIGN;
+        return;
+    }
+    t = fls_word(size);
+    *sl = (size >> (t - TLSF_SL_LOG2)) ^ TLSF_SL_COUNT;
+    *fl = t - (TLSF_FL_SHIFT - 1);
+    if(*fl >= TLSF_FL_COUNT)//larger than TLSF_FL_MAX, all on the last list
+    {
+        *fl = TLSF_FL_COUNT - 1;
+        *sl = TLSF_SL_COUNT - 1;
+    }
+}
 
 
-/*
- * Function implementations
+/* tlsf_find
+ *
+ * finds a free block of at least 'size' bytes, and takes it from its list.
+ * Returns NULL if there is none.
  */
 
-/* init_malloc
- *
- * call to initialise heap space, goes from _end to stack, grows upwards.
- *
- * WARNING: makes use of current maximum stack size. If origin of call is
- * from within a separated stack, which is not located after the heap space
- * (_end), this will return with an error code(-2).
- */ 
- 
-int init_malloc(void)
+static memory_block_header * tlsf_find(unsigned int size)
 {
-    register unsigned char * stack_ptr asm ("sp");//pointer to maximum stack size
-    extern unsigned char   end asm ("end");/* Defined by the linker. heap comes */
+    memory_block_header *h;
+    unsigned int map;
+    unsigned int rounded = size;
+    int fl, sl;
+    
+    //round up to the next list, so any block on the found list will fit
+    if(size >= TLSF_SMALL_BLOCK)
+        rounded += (1 << (fls_word(size) - TLSF_SL_LOG2)) - 1;
+    tlsf_mapping(rounded, &fl, &sl);
+    
+    map = tlsf_sl_bitmap[fl] & (~0U << sl);
+    if(map == 0)//nothing on this first level, try the larger ones
+    {
+        map = tlsf_fl_bitmap & (~0U << (fl + 1));
+        if(map == 0)
+            return NULL;
+        fl = fls_word(map & (0 - map));//lowest bit set
+        map = tlsf_sl_bitmap[fl];
+    }
+    sl = fls_word(map & (0 - map));
+    
+    h = tlsf_blocks[fl][sl];
+    if(BLOCK_SIZE(h) < size)//only possible on the last list
+        return NULL;
+    tlsf_remove(h);
+    return h;
+}
 
-    if((stack_ptr - STACK_MARGIN) < (& end))
-        return -2;//maximum stack size is under _end, so no heap is available
+
+/* tlsf_insert
+ *
+ * puts a free block on the list for its size.
+ */
+
+static void tlsf_insert(memory_block_header *h)
+{
+    int fl, sl;
     
-    heap_end = & end;//do it now
-        
-    global_stack_ptr=(stack_ptr - STACK_MARGIN);
-    free_memory_blocks = NULL;
-    return 0;
+    STATS(free_size += BLOCK_BYTES(h));
+    STATS(free_count++);
+    tlsf_mapping(BLOCK_SIZE(h), &fl, &sl);
+    h->next = tlsf_blocks[fl][sl];
+    FREE_PREV(h) = NULL;
+    if(h->next != NULL)
+        FREE_PREV(h->next) = h;
+    tlsf_blocks[fl][sl] = h;
+    tlsf_fl_bitmap |= 1 << fl;
+    tlsf_sl_bitmap[fl] |= 1 << sl;
 }
 
 
-/* update_heap_size
+/* tlsf_remove
  *
- * call if global stack is changed, to keep heap out of the stack space
+ * takes a free block from its list.
+ */
+
+static void tlsf_remove(memory_block_header *h)
+{
+    int fl, sl;
+    
+    STATS(free_size -= BLOCK_BYTES(h));
+    STATS(free_count--);
+    tlsf_mapping(BLOCK_SIZE(h), &fl, &sl);
+    if(h->next != NULL)
+        FREE_PREV(h->next) = FREE_PREV(h);
+    if(FREE_PREV(h) != NULL)
+        FREE_PREV(h)->next = h->next;
+    else//first on its list
+    {
+        tlsf_blocks[fl][sl] = h->next;
+        if(h->next == NULL)//list is empty now
+        {
+            tlsf_sl_bitmap[fl] &= ~(1 << sl);
+            if(tlsf_sl_bitmap[fl] == 0)
+                tlsf_fl_bitmap &= ~(1 << fl);
+        }
+    }
+}
+
+#else
+/* list_fit
  *
- * WARNING: makes use of current maximum stack size. If origin of call is
- * from within a separated stack, which is not located after the heap space
- * (_end), this will return with an error code(-2).
- * 
- * If new maximum stack pointer is allready in the used portion of the heap,
- * this will return with an error code(-1)
- */ 
+ * takes a block of 'size' bytes(allready aligned) from the free list, and
+ * claims a new piece of heap if nothing fits. The block is split if the rest
+ * is large enough, the used part is taken from its end, so the free part
+ * stays where it is on the list.
+ */
  
-int update_heap_size(void)
+static void * list_fit(unsigned int size)
 {
-    register unsigned char * stack_ptr asm ("sp");//pointer to maximum stack size
-    extern unsigned char   end asm ("end");/* Defined by the linker. heap comes */
+    memory_block_header *h;
     
-    if((stack_ptr - STACK_MARGIN) < (& end))
-        return -2;//new maximum stack pointer lies beneath begining of heap(under _end).
+    h = free_list_find(size);
+    if(h == NULL)//new piece of mem
+    {
+        h = heap_grow(size);
+        if (h == NULL) // no memory availible
+            return NULL;
+        return BLOCK_DATA(h);
+    }
     
-    if(heap_end>(stack_ptr - STACK_MARGIN))
-        return -1;//new maximum stack pointer is allready in used memory space
-        
-    global_stack_ptr=(stack_ptr - STACK_MARGIN);
-    return 0;//all is well, heap maximum is changed.
+    //if there is no room for additional free space
+    if(BLOCK_SIZE(h) < (size + HEADER_SIZE + SPLIT_MIN))
+    {// unlink allocated block from list
+        free_list_remove(h);
+        h->size &= ~BLOCK_FREE;
+        BLOCK_NEXT(h)->size &= ~BLOCK_PREV_FREE;//never past heap_end, see release_block()
+    }    
+    else//there is room for a additional free space, so split
+    {
+        h->size -= (size + HEADER_SIZE);
+        STATS(free_size -= size + HEADER_SIZE);
+        BLOCK_PREV(BLOCK_NEXT(h)) = h;//new footer of the free part
+        h = BLOCK_NEXT(h);//add used memory at end
+        h->size = SIZE_WORD(size) | BLOCK_PREV_FREE;
+        BLOCK_NEXT(h)->size &= ~BLOCK_PREV_FREE;
+    }
+    return BLOCK_DATA(h);// Address following h; is the actual block of data   
 }
 
 
-/* malloc
- *
- * call to allocate a block of memory. Tries to keep the heap small, using first-
- * fit strategy, while not claiming any excess memory. Blocks are a multiple of
- * BLOCK_ALIGN, to avoid data exeptions on the ARM.
- *
- * If an error occured, or there is no memory available anymore;
- * this returns NULL.
+/* free_list_find
  *
- * (this algorithm could be better by checking where the piece fits best, so
- * fragmentation would be kept to a minimum)
+ * searches the free list for a block of 'size' bytes, with the fit policy of
+ * the heap, see MALLOC_FIT. The block stays on the list. Counts the blocks it
+ * looked at for malloc_fit_stats(). Returns NULL if nothing fits.
  */
- 
-void * malloc(unsigned int size)
+
+static memory_block_header * free_list_find(unsigned int size)
 {
     memory_block_header *h;
-    memory_block_header *previous;
+    memory_block_header *found = NULL;
+    memory_block_header *start;
+    unsigned int visits = 0;
     
-    if(size<1)//no memory asked, so no pointer returned.
-        return NULL;
+    switch(fit_policy)
+    {
+    case FIT_NEXT://go on where the last search ended, and wrap around once
+        start = (free_rover != NULL) ? free_rover : free_memory_blocks;
+        for (h = start; h != NULL; )
+        {
+            if (visits == FIT_LIMIT)//give up, the next search goes on from here
+            {
+                free_rover = h;
+                FIT_CUT();
+                break;
+            }
+            visits++;
+            if (BLOCK_SIZE(h) >= size)
+            {
+                free_rover = h;
+                found = h;
+                break;
+            }
+            h = (h->next != NULL) ? h->next : free_memory_blocks;
+            if (h == start)
+                break;
+        }
+        break;
     
-    if((size % BLOCK_ALIGN)>0)//check if block is multiple of BLOCK_ALIGN bytes
-    {//if not, make it aligned by allocating extra bytes.
-	    size -= size % BLOCK_ALIGN;
-	    size += BLOCK_ALIGN;
-	}
+    case FIT_BEST:
+        for (h = free_memory_blocks; h != NULL; h = h->next)
+        {
+            if (visits == FIT_LIMIT)//give up, with the best one so far
+            {
+                FIT_CUT();
+                break;
+            }
+            visits++;
+            if ((BLOCK_SIZE(h) >= size) && ((found == NULL) || (BLOCK_SIZE(h) < BLOCK_SIZE(found))))
+            {
+                found = h;
+                if (BLOCK_SIZE(h) < (size + HEADER_SIZE + SPLIT_MIN))
+                    break;//fits without a rest, nothing will fit better
+            }
+        }
+        break;
     
-    previous = NULL;
-    //check for free blocks, minimum is BLOCK_ALIGN bytes + header size
+    default:
+        for (h = free_memory_blocks; h != NULL; h = h->next)
+        {
+            if (visits == FIT_LIMIT)
+            {
+                FIT_CUT();
+                break;
+            }
+            visits++;
+            if (BLOCK_SIZE(h) >= size)
+            {
+                found = h;
+                break;
+            }
+        }
+        break;
+    }
+#if MALLOC_STATS
+    fit_searches[fit_policy]++;
+    fit_visits[fit_policy] += visits;
+    if(visits > fit_worst[fit_policy])
+        fit_worst[fit_policy] = visits;
+    call_visits += visits;
+#endif
+    return found;
+}
+
+
+/* aligned_fit
+ *
+ * searches the free list for a block that holds 'size' bytes on an 'align'
+ * boundary, and takes it from the list. Slack in front of the aligned spot
+ * must be able to hold a block of its own, see align_block(). Returns NULL if
+ * nothing fits.
+ */
+
+static memory_block_header * aligned_fit(unsigned int size, unsigned int align)
+{
+    memory_block_header *h;
+    char *mem;
+    unsigned int visits = 0;
     
-    //find fitting piece of mem
     for (h = free_memory_blocks; h != NULL; h = h->next)
     {
-        if (h->size >= size)
+        if (visits == FIT_LIMIT)//give up, see MALLOC_BOUNDED
         {
-            //if there is no room for additional free space
-            if(h->size < (size + sizeof(memory_block_header) + BLOCK_ALIGN))
-            {// unlink allocated block from list
-                if (previous == NULL)
-                    free_memory_blocks = h->next; // allocated block is first block on list
-                else
-                    previous->next = h->next;
-                
-            }    
-            else//there is room for a additional free space, so split
-            {
-                h->size -= (size + sizeof(memory_block_header));
-                (char *)h = ((char *)h + h->size + sizeof(memory_block_header));//add used memory at end
-                h->size = size;
-            }
-            return h+1;// Address following h; is the actual block of data   
-        }   
-        previous = h;
+            FIT_CUT();
+            break;
+        }
+        visits++;
+        STATS(call_visits++);
+        mem = (char *)BLOCK_DATA(h);
+        if(ALIGN_PAD(mem, align) != 0)
+        {
+            mem += HEADER_SIZE + MIN_BLOCK_SIZE;
+            mem += ALIGN_PAD(mem, align);
+        }
+        if(mem + size <= (char *)BLOCK_NEXT(h))
+        {
+            free_list_remove(h);
+            h->size &= ~BLOCK_FREE;
+            BLOCK_NEXT(h)->size &= ~BLOCK_PREV_FREE;
+            return h;
+        }
     }
+    return NULL;
+}
+
+
+/* release_block
+ *
+ * puts a block back in the free list, merging it with its neighbours, and
+ * gives it back to the system if it ends up at the end of the heap. The
+ * neighbours are found through the boundary tags, so this takes constant time.
+ */
+
+static void release_block(memory_block_header *h)
+{
+    memory_block_header *n;
     
-    //new piece of mem
-    (unsigned char *)h = _sbrk(sizeof (memory_block_header) + size);
+    if(h->size & BLOCK_PREV_FREE)//merge with the free block in front of it
+    {
+        n = BLOCK_PREV(h);
+        free_list_remove(n);
+        WALKER_MOVE(h, n);
+        n->size += BLOCK_SIZE(h) + HEADER_SIZE;
+        h = n;
+    }
     
-    if (h == (memory_block_header *)-1) // no memory availible
-        return NULL;
+    n = BLOCK_NEXT(h);
+    if((unsigned char *)n >= heap_end)//chunk is last in heap, give mem back to system.
+    {
+        _sbrk(0 - (BLOCK_SIZE(h) + HEADER_SIZE));
+        return;
+    }
     
-    h->size = size;
-    h->next = NULL;
+    if(n->size & BLOCK_FREE)//merge with the free block after it
+    {
+        free_list_remove(n);
+        WALKER_MOVE(n, h);
+        h->size += BLOCK_SIZE(n) + HEADER_SIZE;
+        n = BLOCK_NEXT(h);
+    }
     
-    return h + 1;
+    h->size |= BLOCK_FREE;
+    BLOCK_PREV(n) = h;//write the footer
+    n->size |= BLOCK_PREV_FREE;
+    free_list_insert(h);
 }
 
 
-/* free
- * 
- * call to free a block of memory, that is allocated by malloc. Tries to merge
- * free blocks and resizes heap if memory is freed at the end of the heap.
+/* free_list_insert
+ *
+ * puts a free block on the end of the free list. The list is no longer in
+ * address order, but adding to the end keeps the oldest free blocks in front,
+ * which fragments about as little as the address order did. Adding to the
+ * front would reuse the newest blocks first, and fragment a lot more.
  */
- 
-void free(void * mem_chunk)
+
+static void free_list_insert(memory_block_header *h)
 {
-    extern unsigned char   end asm ("end");// Defined by the linker. heap comes here after
-    memory_block_header *h;
-    memory_block_header *n;
-    memory_block_header *previous=NULL;
-    
-    if((char *)mem_chunk == NULL)//check if pointer != NULL
-        return;
+    STATS(free_size += BLOCK_BYTES(h));
+    STATS(free_count++);
+    h->next = NULL;
+    FREE_PREV(h) = free_memory_tail;
+    if(free_memory_tail != NULL)
+        free_memory_tail->next = h;
+    else//list was empty
+        free_memory_blocks = h;
+    free_memory_tail = h;
+}
 
-    //check if pointer between bss end and stack top.
-    if(((unsigned char *)mem_chunk < (unsigned char *)(& end)) || ((unsigned char *)mem_chunk > heap_end))
-        return;
-        
-    h = (memory_block_header *) mem_chunk;
-    h = h - 1;   // Back up to the header itself
 
-    //place block in mem at right place
-    //and merge with ajacent free blocks      
-    for(n = free_memory_blocks; n != NULL; n = n->next)
+/* free_list_remove
+ *
+ * takes a free block from the free list.
+ */
+
+static void free_list_remove(memory_block_header *h)
+{
+    if(free_rover == h)//keep it on the list, also when h is merged
+        free_rover = h->next;
+    STATS(free_size -= BLOCK_BYTES(h));
+    STATS(free_count--);
+    if(h->next != NULL)
+        FREE_PREV(h->next) = FREE_PREV(h);
+    else//last on the list
+        free_memory_tail = FREE_PREV(h);
+    if(FREE_PREV(h) != NULL)
+        FREE_PREV(h)->next = h->next;
+    else//first on the list
+        free_memory_blocks = h->next;
+}
+
+
+#if QUICK_LIST_MAX > 0
+/* flush_quick_lists
+ *
+ * feeds up to 'count' blocks on the quick lists back into the free list, so
+ * they can be merged. A malloc flushes FIT_LIMIT, so it takes bounded time
+ * with MALLOC_BOUNDED, the rest waits for the next one. Returns 0 if there was
+ * nothing to flush.
+ */
+
+static int flush_quick_lists(unsigned int count)
+{
+    memory_block_header *h;
+    int i;
+    int flushed = 0;
+
+    for(i = 0; i < QUICK_LIST_COUNT; i++)
     {
-        if(n > h)//found next free space
+        while((h = quick_lists[i]) != NULL)
         {
-            if(previous == NULL)//first in list
-            {
-                if((char *)n == (char *)h + h->size + sizeof(memory_block_header))//space can be merged with next free block
-                {
-                     h->next = n->next;//point to next free block
-                     h->size += n->size + sizeof(memory_block_header); //merge size
-                }
-                else// space can not be merged
-                {
-                     h->next = n;// just add the item on front of list
-                }
-                free_memory_blocks = h;//redefine the start of the list
-            }
-            else//not first in list
+            if(count-- == 0)
             {
-                if((char *)previous + previous->size + sizeof(memory_block_header) == (char *)h)//space can be merged
-                {//with previous free block
-                    previous->size += h->size + sizeof(memory_block_header);//just add it to the previous block
-                    h = previous;//merge pointers
-                }
-                else// space can not be merged with previous block
-                {
-                    previous->next = h;//redefine 'next' pointer of previous
-                }
-                if((char *)n == (char *)h + h->size + sizeof(memory_block_header))//space can be merged
-                {//with next free block
-                     h->next = n->next;//point to next free block
-                     h->size += n->size + sizeof(memory_block_header);//add size to current block
-                }
-                else// space can not be merged with next free block
-                {
-                    h->next = n;//point to next in list
-                }
+                FIT_CUT();
+                return flushed;
             }
-            return;
-        }  
-        previous = n;
-    }  
-    //block is located after last free block
-    if(n==NULL)
-    {
-	    if(previous == NULL)//no list defined yet
-	    {   //the last piece, so add to list
-            free_memory_blocks = h;
-            h->next=NULL;//last in list, so next is NULL
-		}
-		else//list defined, so append
-        {
-            if((char *)previous + previous->size + sizeof(memory_block_header) == (char *)h)//space can be merged
-            {//with previous free block
-                previous->size += h->size + sizeof(memory_block_header);//just add it to the previous block
-                h = previous;//merge pointers
-            }
-            else// space can not be merged with previous block
-			{
-			    previous->next = h;
-			    h->next=NULL;//last in list, so next is NULL
-			}
-        }
-        //if it is last block in heap, give mem back to system.
-        if( (unsigned char *)((char *)h + h->size + sizeof(memory_block_header)) >= heap_end)//chunk is last in heap
-        {
-            _sbrk(0 - (h->size + sizeof(memory_block_header)));//return all mem
-            if(previous == NULL)
-                free_memory_blocks = NULL;
-            else//ugly hack, but better than implementing a doubly linked list
-            {
-                if(free_memory_blocks == h)
-                    free_memory_blocks = NULL;
-                    
-                for(n = free_memory_blocks; n != NULL; n = n->next)
-                {
-                    if(n->next == h)
-                        n->next = NULL;
-				}
-			}
+            quick_lists[i] = h->next;//pop it, and merge it into the free list
+            STATS(cached_size -= BLOCK_BYTES(h));
+            STATS(call_visits++);
+            release_block(h);
+            flushed = 1;
         }
-    }    
-    return;
+    }
+    return flushed;
 }
+#endif
+#endif
 
 
 /* _sbrk
@@ -345,18 +4028,32 @@ void free(void * mem_chunk)
  
 volatile unsigned char * _sbrk (int incr)
 {
-    extern unsigned char   end asm ("end");// Defined by the linker. heap comes here after
     unsigned char *        prev_heap_end;
   
     prev_heap_end = heap_end;
   
     //check if the block is located in heap.
-    if((heap_end + incr > global_stack_ptr) || (heap_end + incr < (&end)))
+    if((heap_end + incr > heap_limit) || (heap_end + incr < heap_start))
     {
         return (volatile unsigned char *) -1;
     }
   
     heap_end += incr;
+    if(heap_end > heap_top)//claim it, and a bit more
+        heap_top = ((unsigned int)(heap_limit - heap_end) > TOP_PAD) ? heap_end + TOP_PAD : heap_limit;
+    else if((unsigned int)(heap_top - heap_end) > TRIM_THRESHOLD)//enough left over, give it back
+        heap_top = heap_end + TOP_PAD;
+    if(heap_end > peak_end)
+        peak_end = heap_end;
+    if((active_walker != NULL) && (active_walker->next >= heap_end))//shrunk under it
+    {
+        active_walker->next = NULL;
+        active_walker = NULL;
+    }
+#if CALLOC_ZERO_HEAP
+    if(heap_end > heap_clean)//memory under it has been used now
+        heap_clean = heap_end;
+#endif
 
     return (volatile unsigned char *) prev_heap_end;
 }
@@ -18,7 +18,10 @@
  * This malloc function tries to cope with memory effinciently, without re-
  * organising any used blocks, and with returning aligned blocks of memory.
  * It also allows for the stack/heap to expand/shrink dynamically.
- * It uses a first-fit strategy, and tries to keep any excess memory available.
+ * It uses a first-fit strategy(or next/best fit, see MALLOC_FIT), and tries
+ * to keep any excess memory available.
+ * Free blocks carry boundary tags, so merging them takes constant time.
+ * (or a TLSF engine, with constant time malloc/free, see MALLOC_TLSF)
  * It has a minimum size for blocks, so any size under this will be resized to
  * this.
  *
@@ -45,6 +48,183 @@
 #endif
 
 
+/*
+ * Global types
+ */
+
+/* trace_record
+ *
+ * one call to malloc and friends, as recorded with MALLOC_TRACE, see
+ * trace_read. 'addr' is the block returned or freed, as offset from 'end'
+ * (0 is NULL). 'prio' is the task priority, or TRACE_NO_TASK, and 'tick' the
+ * lower 16 bits of OSTimeGet(), both only with MALLOC_UCOS.
+ *
+ * realloc and memalign have an extra argument, which is recorded first in a
+ * TRACE_ARG record of the same task: the old block in 'addr' for realloc, and
+ * the alignment in 'size' for memalign.
+ */
+typedef struct trace_record {
+    unsigned char                op;//what was called, see below
+    unsigned char                prio;
+    unsigned short               tick;
+    unsigned int                 size;//bytes asked
+    unsigned int                 addr;
+} trace_record;
+
+#define TRACE_MALLOC    1
+#define TRACE_FREE      2
+#define TRACE_CALLOC    3//size is count * size
+#define TRACE_REALLOC   4
+#define TRACE_MEMALIGN  5
+#define TRACE_ARG       6//extra argument of the next record of this task
+#define TRACE_LOST      7//'size' records did not fit in the buffer
+
+#define TRACE_NO_TASK   0xff
+
+
+/* heap_stats
+ *
+ * heap usage, as returned by malloc_stats. All sizes are in bytes, with the
+ * block headers included, so used + free + cached adds up to heap_size.
+ * Cached are the freed blocks on the quick lists. Blocks kept in the
+ * magazines of tasks(MALLOC_UCOS) count as used, free slots of
+ * slabs(SLAB_MAX) and free blocks of the reserve(MALLOC_BOUNDED) as cached,
+ * and the rest of a slab as used.
+ */
+typedef struct heap_stats {
+    unsigned int                 heap_size;//from 'end' up to heap_end
+    unsigned int                 heap_peak;//largest heap_size since init_malloc
+    unsigned int                 heap_room;//the heap can still grow this much
+    unsigned int                 used_bytes;//in blocks in use
+    unsigned int                 free_bytes;//in free blocks
+    unsigned int                 free_blocks;
+    unsigned int                 cached_bytes;//freed, but not merged yet, see above
+    unsigned int                 failed;//allocations that returned NULL
+} heap_stats;
+
+
+/* heap_block
+ *
+ * one block of the heap, as found by heap_walk. 'size' is what malloc could
+ * hand out of it, the header not included. Blocks on the quick lists and in
+ * the magazines are not free for this, they are not merged yet.
+ */
+typedef struct heap_block {
+    void                        *mem;//what malloc returned for it
+    unsigned int                 size;
+    int                          free;
+} heap_block;
+
+
+/* heap_walker
+ *
+ * a walk over the heap, see heap_walk_start, and its summary so far. Sizes
+ * are in bytes, without the headers. histogram[i] counts the free blocks of
+ * BLOCK_ALIGN << i bytes up to twice that, the last one all larger blocks.
+ * 'fragmentation' is the part(in percent) of the free bytes that is not in
+ * the largest free block: 0 is one free block, near 100 is many small ones.
+ */
+#define HEAP_HISTOGRAM  12
+
+typedef struct heap_walker {
+    unsigned char               *next;//block to visit next, NULL when done
+    unsigned int                 used_bytes;
+    unsigned int                 used_blocks;
+    unsigned int                 free_bytes;
+    unsigned int                 free_blocks;
+    unsigned int                 largest_free;
+    unsigned int                 fragmentation;
+    unsigned int                 histogram[HEAP_HISTOGRAM];
+} heap_walker;
+
+
+/* malloc errors
+ *
+ * passed to the hook set with set_malloc_hook, with MALLOC_DEBUG. The last
+ * two are returned by malloc_error, with MALLOC_BOUNDED.
+ */
+#define MALLOC_BAD_POINTER  1//not in the heap
+#define MALLOC_BAD_BLOCK    2//not handed out by malloc, or freed twice
+#define MALLOC_OVERRUN      3//written past the end of the block
+#define MALLOC_NO_MEMORY    4//nothing fits, and the heap can not grow
+#define MALLOC_TIME_BOUND   5//gave up searching, and the reserve had nothing
+
+
+/* fit policies
+ *
+ * how the first-fit engine picks a free block, see MALLOC_FIT in malloc.c and
+ * malloc_set_policy.
+ */
+#define FIT_FIRST       0
+#define FIT_NEXT        1
+#define FIT_BEST        2
+#define FIT_COUNT       3
+
+
+/* fit_stats
+ *
+ * the free list searches of each fit policy, as returned by malloc_fit_stats,
+ * indexed by FIT_FIRST, FIT_NEXT and FIT_BEST. visits / searches is the
+ * average number of free blocks a malloc looked at with that policy.
+ * worst_call is the most blocks one malloc or memalign went through in all,
+ * its searches and the blocks it flushed from the quick lists together.
+ */
+typedef struct fit_stats {
+    int                          policy;//the one in use, -1 with TLSF
+    unsigned int                 searches[FIT_COUNT];
+    unsigned int                 visits[FIT_COUNT];//free blocks looked at
+    unsigned int                 worst[FIT_COUNT];//most looked at in one search
+    unsigned int                 worst_call;//most gone through in one call
+} fit_stats;
+
+
+/* wcet_site
+ *
+ * the calls made from one place in the code, as returned by malloc_wcet with
+ * WCET_SITES. 'site' is the return address of the call, look it up in the
+ * map file, and 'worst' the longest one took, in ticks of WCET_CLOCK().
+ */
+typedef struct wcet_site {
+    void                        *site;
+    unsigned char                op;//TRACE_MALLOC, TRACE_FREE, ...
+    unsigned int                 calls;
+    unsigned int                 worst;
+} wcet_site;
+
+
+/* heap
+ *
+ * an extra heap in a region of RAM, see heap_create. Its members are used by
+ * malloc.c only.
+ */
+typedef struct heap heap;
+
+
+/* stack_pool
+ *
+ * a pool of equal sized task stacks, see init_stack_pool. The members are
+ * used by the pool functions only.
+ */
+typedef struct stack_pool {
+    void                        *stacks;//free stacks, linked by their first word
+    unsigned int                 size;//bytes per stack
+    unsigned char               *start;//memory of the pool
+    unsigned char               *end;
+} stack_pool;
+
+
+/* arena
+ *
+ * a chunk of the heap that hands out pieces by moving a pointer up, see
+ * init_arena. The members are used by the arena functions only.
+ */
+typedef struct arena {
+    unsigned char               *start;//the chunk
+    unsigned char               *next;//first byte not handed out
+    unsigned char               *end;
+} arena;
+
+
 /*
  * Global functions
  */
@@ -69,32 +249,306 @@ int      init_malloc(void);
  * (_end), this will return with an error code(-2).
  * 
  * If new maximum stack pointer is allready in the used portion of the heap,
- * this will return with an error code(-1)
+ * or in the memory the heap keeps above it(see malloc_trim), this will return
+ * with an error code(-1)
  */ 
 int      update_heap_size(void);
 
 
+/* malloc_trim
+ *
+ * call to give the memory the heap keeps above its end back to the stack,
+ * except for 'pad' bytes (see TRIM_THRESHOLD and TOP_PAD in malloc.c), e.g.
+ * before update_heap_size. Returns 1 if any memory was given back.
+ */
+int      malloc_trim(unsigned int pad);
+
+
 /* malloc
  *
  * call to allocate a block of memory. Tries to keep the heap small, using first-
  * fit strategy, while not claiming any excess memory. Blocks are a multiple of
  * BLOCK_ALIGN, to avoid data exeptions on the ARM.
+ * Small blocks(up to QUICK_LIST_MAX) are taken from the quick lists first,
+ * tiny objects(up to SLAB_MAX) from a slab, without a header.
  *
  * If an error occured, or there is no memory available anymore;
  * this returns NULL.
  *
- * (this algorithm could be better by checking where the piece fits best, so
- * fragmentation would be kept to a minimum)
+ * (where the piece fits best keeps fragmentation lower, at the cost of a
+ * longer search, see malloc_set_policy)
  */
 void    *malloc(unsigned int size);
 
 
 /* free
  * 
- * call to free a block of memory, that is allocated by malloc. Tries to merge
- * free blocks and resizes heap if memory is freed at the end of the heap.
+ * call to free a block of memory, that is allocated by malloc. Merges it with
+ * the free blocks in front of and after it, and resizes heap if memory is freed
+ * at the end of the heap. Small blocks are put on their quick list instead, unmerged,
+ * or with MALLOC_UCOS in the magazine of the calling task.
  */
 void     free(void * mem_chunk);
 
 
+/* calloc
+ *
+ * call to allocate a block of memory for 'count' elements of 'size' bytes,
+ * cleared to zero. Memory the heap never used before is not cleared again
+ * (see CALLOC_ZERO_HEAP in malloc.c).
+ *
+ * If an error occured, or there is no memory available anymore;
+ * this returns NULL.
+ */
+void    *calloc(unsigned int count, unsigned int size);
+
+
+/* memalign, aligned_alloc
+ *
+ * call to allocate a block of memory that starts on a multiple of 'align'
+ * bytes, which must be a power of two, for DMA buffers and the like. The slack
+ * in front of and after the block is given back to the heap as free blocks.
+ *
+ * If an error occured, 'align' is not a power of two, or there is no memory
+ * available anymore; this returns NULL.
+ */
+void    *memalign(unsigned int align, unsigned int size);
+void    *aligned_alloc(unsigned int align, unsigned int size);
+
+
+/* realloc
+ *
+ * call to resize a block of memory, that is allocated by malloc. Shrinks and
+ * grows the block in place when possible (the block after it is free, or it is
+ * the last block in heap), else moves it to a new block.
+ *
+ * Returns the (possibly moved) block, or NULL if there is no memory available
+ * anymore, in which case the old block is left as it was. A NULL pointer acts
+ * as malloc, a size of 0 as free.
+ */
+void    *realloc(void * mem_chunk, unsigned int size);
+
+
+/* heap_create, heap_malloc, heap_free
+ *
+ * an extra heap, next to the default one from 'end' up to the stack, so one
+ * part of the program can not fragment the memory of another, e.g. a heap for
+ * network buffers, or one in the second RAM bank of the larger LPC21xx parts.
+ * heap_create starts a heap in the 'len' bytes at 'base', which then belong
+ * to the heap. It returns NULL if they can not hold a single block. A few
+ * bytes at the start of the region are used to keep track of the heap.
+ *
+ * heap_malloc and heap_free are malloc and free on heap 'h', with NULL for
+ * the default heap. Blocks must be given back to the heap they came from.
+ * Only the default heap is traced, walked, counted by malloc_stats, and has
+ * the magazines of MALLOC_UCOS.
+ */
+heap    *heap_create(void *base, unsigned int len);
+void    *heap_malloc(heap *h, unsigned int size);
+void     heap_free(heap *h, void * mem_chunk);
+
+
+/* malloc_stats
+ *
+ * call to get the heap usage in 'stats'. The counters are kept up to date by
+ * malloc and free, so this takes constant time, and can be called as often as
+ * needed.
+ */
+void     malloc_stats(heap_stats *stats);
+
+
+/* malloc_set_policy, malloc_fit_stats
+ *
+ * malloc_set_policy changes the fit policy of the default heap at run time,
+ * e.g. to try each one on the same load and keep the best. It returns the
+ * old policy, or -1 if 'policy' is not a FIT_ name or the engine is TLSF.
+ * malloc_fit_stats gets the number of free blocks the searches looked at,
+ * per policy, since init_malloc.
+ */
+int      malloc_set_policy(int policy);
+void     malloc_fit_stats(fit_stats *stats);
+
+
+/* malloc_error
+ *
+ * call after a malloc, calloc, realloc or memalign of the calling task
+ * returned NULL, to know why: MALLOC_TIME_BOUND if the search gave up after
+ * MALLOC_BOUNDED free blocks, and the reserve had no block for it either,
+ * else MALLOC_NO_MEMORY. Only available when malloc.c is compiled with
+ * MALLOC_BOUNDED.
+ */
+int      malloc_error(void);
+
+
+/* malloc_wcet
+ *
+ * call to copy the worst time per call site into 'sites', at most 'count' of
+ * them. Returns the number copied. The table is cleared by init_malloc. Only
+ * available when malloc.c is compiled with WCET_SITES.
+ */
+unsigned int malloc_wcet(wcet_site *sites, unsigned int count);
+
+
+/* heap_walk_start, heap_walk, heap_walk_steps, heap_walk_stop
+ *
+ * walk over every block from 'end' to heap_end, used and free, and sum them
+ * up in the walker. heap_walk_start starts a walk, heap_walk returns the next
+ * block, and heap_walk_steps walks on for at most 'steps' blocks, for the
+ * summary only. Both return 0 when the walk is done. A walk that is left
+ * before it is done must be ended with heap_walk_stop, as the heap keeps a
+ * pointer to the walker until then. The heap is only locked
+ * while a call runs, so a walk can be spread over time, e.g.:
+ *
+ *     heap_walk_start(&walker);
+ *     while(heap_walk_steps(&walker, 16))
+ *         OSTimeDly(1);
+ *
+ * The heap may change between calls, which makes the summary approximate.
+ * Only one walk at a time is kept up to date with the heap, starting a new
+ * one ends the one before.
+ */
+void     heap_walk_start(heap_walker *walker);
+int      heap_walk(heap_walker *walker, heap_block *block);
+int      heap_walk_steps(heap_walker *walker, unsigned int steps);
+void     heap_walk_stop(heap_walker *walker);
+
+
+/* trace_read
+ *
+ * call to take the oldest record from the trace. Returns 0 if there is none.
+ * Only available when malloc.c is compiled with MALLOC_TRACE.
+ */
+int      trace_read(trace_record *record);
+
+
+/* set_malloc_hook
+ *
+ * call to have 'hook' called when free or realloc gets a bad block, with one
+ * of the malloc errors above and the pointer it got. The block is then left
+ * alone. Only available when malloc.c is compiled with MALLOC_DEBUG.
+ */
+void     set_malloc_hook(void (*hook)(int error, void *mem));
+
+
+/* flush_magazine
+ *
+ * gives the blocks in the magazine of the calling task back to the heap. Call
+ * before a task deletes itself, or its blocks stay with its priority. Only
+ * does something when malloc.c is compiled with MALLOC_UCOS.
+ */
+void     flush_magazine(void);
+
+
+/* free_all_for_task
+ *
+ * frees every block task 'prio'(or OS_PRIO_SELF) allocated with malloc,
+ * calloc, realloc or memalign and did not free yet, and empties its magazine.
+ * Call it right after OSTaskDel() of a task, from the task that deleted it,
+ * so nothing it allocated leaks. Not from OSTaskDelHook(), which runs with the
+ * interrupts disabled, while the heap lock is OSSchedLock(). A task may also
+ * call it with OS_PRIO_SELF before it deletes itself, as long as its own
+ * stack was not allocated by itself. A block that realloc moved belongs to
+ * the task that called realloc. Returns the number of blocks freed, allways
+ * 0 unless malloc.c is compiled with MALLOC_OWNER.
+ */
+int      free_all_for_task(unsigned int prio);
+
+
+/* malloc_set_owner
+ *
+ * hands the block of 'mem', from malloc, calloc, realloc or memalign, to task
+ * 'prio'(or OS_PRIO_SELF), so free_all_for_task(prio) frees it, and not
+ * free_all_for_task of the task that allocated it. E.g. the stack a task
+ * allocates for a task it creates:
+ *
+ *     stk = malloc(size);
+ *     malloc_set_owner(stk, prio);
+ *     OSTaskCreateExt(task, pdata, &stk[size/sizeof(OS_STK)-1], prio, ...);
+ *
+ * Does nothing unless malloc.c is compiled with MALLOC_OWNER.
+ */
+void     malloc_set_owner(void *mem, unsigned int prio);
+
+
+/* malloc_from_isr, free_from_isr, flush_isr_frees
+ *
+ * malloc and free for interrupts, which must not call malloc or free
+ * themselves. malloc_from_isr takes a block of up to ISR_POOL_SIZE bytes from
+ * a small pool that init_malloc sets apart, and returns NULL if it is empty.
+ * free_from_isr takes any block, it goes back to the pool, or is put on a
+ * list that the next malloc or free of a task gives back to the heap, with
+ * MALLOC_BOUNDED at most that many per call. Both only mask the interrupts
+ * for a few instructions. flush_isr_frees empties the list, and fills the
+ * pool again, e.g. from the idle task hook. Only
+ * available when malloc.c is compiled with MALLOC_ISR, see ISR_POOL_COUNT.
+ */
+void    *malloc_from_isr(unsigned int size);
+void     free_from_isr(void * mem_chunk);
+void     flush_isr_frees(void);
+
+
+/* init_stack_pool
+ *
+ * call to carve a pool of 'count' task stacks of 'size' bytes from the heap.
+ * The whole pool is one heap block, so the stacks have no header of their own
+ * and are never split up by other allocations. If the heap can not hold them
+ * all, the pool gets as many as fit.
+ *
+ * Returns the number of stacks in the pool, 0 if there is no memory at all.
+ */
+int      init_stack_pool(stack_pool *pool, unsigned int size, unsigned int count);
+
+
+/* get_stack
+ *
+ * call to take a stack from the pool, in constant time. Returns a pointer to
+ * the lowest address of the stack(what OSTaskCreateExt calls pbos), or NULL if
+ * all stacks are in use.
+ */
+void    *get_stack(stack_pool *pool);
+
+
+/* put_stack
+ *
+ * call to give a stack back to the pool, in constant time. Stacks that are not
+ * from this pool are ignored.
+ */
+void     put_stack(stack_pool *pool, void *stack);
+
+
+/* shrink_stack
+ *
+ * call to give the unused low end of a task stack that was allocated with
+ * malloc back to the heap, keeping the 'size' bytes at its top. Returns the
+ * new lowest address of the stack(pbos), which must then go in the OS_TCB of
+ * the task, together with the new size, see applic/stack.c. Stacks of a
+ * stack_pool can not be shrunk.
+ */
+void    *shrink_stack(void * stack, unsigned int size);
+
+
+/* init_arena, arena_alloc, arena_mark, arena_release, arena_reset, free_arena
+ *
+ * an arena, for many small blocks that are given back all at once, such as
+ * the temporaries of handling one message. init_arena takes one chunk of
+ * 'size' bytes from the heap, and returns 0 if there is no memory for it.
+ * arena_alloc then hands out pieces of it without a header, by moving a
+ * pointer up, and returns NULL when the chunk is full. The pieces are not
+ * freed one by one: arena_mark returns the spot the arena is at, and
+ * arena_release gives back all pieces taken since then, so marks can be
+ * nested like scopes. arena_reset gives back all pieces, and free_arena gives
+ * the chunk back to the heap. An arena is not locked, keep it to one task:
+ *
+ *     void *mark = arena_mark(&scratch);
+ *     ...arena_alloc(&scratch, sizeof(item))...
+ *     arena_release(&scratch, mark);
+ */
+int      init_arena(arena *a, unsigned int size);
+void    *arena_alloc(arena *a, unsigned int size);
+void    *arena_mark(arena *a);
+void     arena_release(arena *a, void *mark);
+void     arena_reset(arena *a);
+void     free_arena(arena *a);
+
+
 #endif    /*MALLOC_H*/
@@ -0,0 +1,189 @@
+//////////////////////////////////////////////////////////////////////////////
+// prog: stack.c
+// comm: gives the dynamic tasks a stack from the heap, and with STACK_PROFILE
+//       shrinks it to what the task uses once OSTaskStkChk shows its
+//       high-water mark is stable
+// auth: MSC
+//////////////////////////////////////////////////////////////////////////////
+
+#include <includes.h>
+
+#include <main.h>
+#include "malloc.h"
+
+#if defined(STACK_PROFILE) && STACK_PROFILE
+// the stack of each priority that StackCreate gave a task
+static struct
+{
+    OS_STK *bottom;     // lowest address, as malloc returned it
+    INT32U  used;       // last high-water mark, in bytes
+    INT8U   stable;     // checks the high-water mark did not change
+} Stacks[OS_LOWEST_PRIO + 1];
+#endif
+
+// high-water marks of an earlier boot, see StackTask
+static const INT32U Profile[][2] = { STACK_SIZES {0, 0} };
+
+//////////////////////////////////////////////////////////////////////////////
+// func: StackCreate
+// args: task, pdata and prio as for OSTaskCreate; size, in OS_STK entries
+// comm: creates a task with a stack from the heap. A priority in
+//       STACK_SIZES gets the bytes it used on an earlier boot plus
+//       STACK_HEADROOM instead of 'size'. The stack belongs to the new task,
+//       so free_all_for_task(prio) frees it with MALLOC_OWNER. Returns the
+//       OSTaskCreateExt error, or OS_MEM_NO_FREE_BLKS if the heap is full
+//////////////////////////////////////////////////////////////////////////////
+INT8U StackCreate(void (*task)(void *pd), void *pdata, INT8U prio, INT32U size)
+{
+    OS_STK *stk;
+    INT8U err;
+    int i;
+
+    if(prio > OS_LOWEST_PRIO)
+        return OS_PRIO_INVALID;
+
+    for(i = 0; Profile[i][1] != 0; i++)
+    {
+        if(Profile[i][0] == prio)
+        {
+            size = (Profile[i][1] + STACK_HEADROOM + sizeof(OS_STK) - 1) / sizeof(OS_STK);
+            break;
+        }
+    }
+
+    stk = (OS_STK *)malloc(size * sizeof(OS_STK));
+    if(stk == NULL)
+        return OS_MEM_NO_FREE_BLKS;
+    malloc_set_owner(stk, prio);//not of the task that called StackCreate
+
+#if defined(STACK_PROFILE) && STACK_PROFILE
+    Stacks[prio].bottom = stk;
+    Stacks[prio].used = 0;
+    Stacks[prio].stable = 0;
+#endif
+    // clear the stack, so OSTaskStkChk can find how far it was used
+    err = OSTaskCreateExt(task, pdata, &stk[size-1], prio, prio, stk, size, NULL,
+                          OS_TASK_OPT_STK_CHK | OS_TASK_OPT_STK_CLR);
+    if(err != OS_NO_ERR)
+    {
+#if defined(STACK_PROFILE) && STACK_PROFILE
+        Stacks[prio].bottom = NULL;
+#endif
+        free(stk);
+    }
+    return err;
+}
+
+#if defined(STACK_PROFILE) && STACK_PROFILE
+
+//////////////////////////////////////////////////////////////////////////////
+// func: StackGone
+// args: prio, of a task created with StackCreate
+// comm: returns TRUE if the task no longer runs on the stack StackCreate gave
+//       it. The stack is freed if the task was deleted, with MALLOC_OWNER
+//       together with what else the task left, unless the task that deleted
+//       it did so allready. The scheduler must be locked
+//////////////////////////////////////////////////////////////////////////////
+static BOOLEAN StackGone(INT8U prio)
+{
+    OS_TCB inf;
+
+    if(OSTaskQuery(prio, &inf) != OS_NO_ERR)//task was deleted, its stack is no longer used
+    {
+#if defined(MALLOC_OWNER) && MALLOC_OWNER
+        free_all_for_task(prio);//the stack is one of its blocks, see StackCreate
+#else
+        free(Stacks[prio].bottom);
+#endif
+        Stacks[prio].bottom = NULL;
+        return TRUE;
+    }
+    if(inf.OSTCBStkBottom != Stacks[prio].bottom)//another task got the priority
+    {
+        Stacks[prio].bottom = NULL;
+        return TRUE;
+    }
+    return FALSE;
+}
+
+//////////////////////////////////////////////////////////////////////////////
+// func: StackShrink
+// args: prio, of a task created with StackCreate; keep, bytes to keep
+// comm: gives the low end of the stack back to the heap, and tells uC/OS-II
+//       where the stack begins now. The scheduler must be locked
+//////////////////////////////////////////////////////////////////////////////
+static void StackShrink(INT8U prio, INT32U keep)
+{
+#if OS_CRITICAL_METHOD == 3
+    OS_CPU_SR cpu_sr = 0;
+#endif
+    OS_TCB *ptcb = OSTCBPrioTbl[prio];
+    OS_STK *top;
+    OS_STK *bottom;
+
+    // the end of the block may lie a few bytes past the top, those come out
+    // of the headroom
+    top = ptcb->OSTCBStkBottom + ptcb->OSTCBStkSize;
+    bottom = (OS_STK *)shrink_stack(Stacks[prio].bottom, keep);
+    Stacks[prio].bottom = bottom;
+
+    OS_ENTER_CRITICAL();//OSTaskStkChk of the statistics task reads these
+    ptcb->OSTCBStkBottom = bottom;
+    ptcb->OSTCBStkSize = top - bottom;
+    OS_EXIT_CRITICAL();
+}
+
+//////////////////////////////////////////////////////////////////////////////
+// func: StackTask
+// args: void *pdata, needed by os
+// comm: checks the stacks of the tasks from StackCreate every STACK_PERIOD
+//       ticks, and frees those of deleted tasks. When the high-water mark
+//       of a stack did not change for STACK_STABLE checks, the stack is
+//       shrunk to it plus STACK_HEADROOM, and a line "S: {prio, bytes}," goes
+//       to the uart. There is no flash to keep these in, copy the lines into
+//       STACK_SIZES in main.h to size the stacks on the next boot
+//////////////////////////////////////////////////////////////////////////////
+void StackTask(void *pdata)
+{
+    OS_STK_DATA data;
+    INT8U prio;
+
+    while(TRUE)
+    {
+        OSTimeDly(STACK_PERIOD);
+        for(prio = 0; prio <= OS_LOWEST_PRIO; prio++)
+        {
+            if(Stacks[prio].bottom == NULL)
+                continue;
+
+            OSSchedLock();
+            if(StackGone(prio) || Stacks[prio].stable >= STACK_STABLE ||
+               OSTaskStkChk(prio, &data) != OS_NO_ERR)
+            {
+                OSSchedUnlock();
+                continue;
+            }
+            if(data.OSUsed != Stacks[prio].used)
+            {
+                Stacks[prio].used = data.OSUsed;
+                Stacks[prio].stable = 0;
+                OSSchedUnlock();
+                continue;
+            }
+            if(++Stacks[prio].stable == STACK_STABLE)
+                StackShrink(prio, data.OSUsed + STACK_HEADROOM);
+            OSSchedUnlock();
+
+            if(Stacks[prio].stable == STACK_STABLE)
+            {
+                UART_put("\n\rS: {");
+                UART_putint(prio);
+                UART_put(", ");
+                UART_putint(data.OSUsed);
+                UART_put("},");
+            }
+        }
+    }
+}
+
+#endif
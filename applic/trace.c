@@ -0,0 +1,60 @@
+//////////////////////////////////////////////////////////////////////////////
+// prog: trace.c
+// comm: sends the allocation trace of malloc.c over the uart, to be replayed
+//       on the host with host/malloc_replay
+// auth: MSC
+//////////////////////////////////////////////////////////////////////////////
+
+#include <includes.h>
+
+#include <main.h>
+#include "malloc.h"
+
+#if defined(MALLOC_TRACE) && MALLOC_TRACE
+
+//////////////////////////////////////////////////////////////////////////////
+// func: put_hex
+// args: char *line, where to write; value, what to write; digits, how many
+// comm: writes 'value' as 'digits' hexadecimal digits, returns the end
+//////////////////////////////////////////////////////////////////////////////
+static char *put_hex(char *line, unsigned int value, int digits)
+{
+    while(digits-- > 0)
+        *line++ = "0123456789abcdef"[(value >> (digits * 4)) & 0xf];
+    return line;
+}
+
+//////////////////////////////////////////////////////////////////////////////
+// func: TraceTask
+// args: void *pdata, needed by os
+// comm: takes the records from the trace, and sends each as a line of
+//       "T:" followed by op, prio, tick, size and addr in hex
+//////////////////////////////////////////////////////////////////////////////
+void TraceTask (void *pdata)
+{
+    trace_record record;
+    char line[2 + 2 + 2 + 4 + 8 + 8 + 3];
+    char *p;
+    
+    while(TRUE) 
+    {
+        while(trace_read(&record))
+        {
+            p = line;
+            *p++ = 'T';
+            *p++ = ':';
+            p = put_hex(p, record.op, 2);
+            p = put_hex(p, record.prio, 2);
+            p = put_hex(p, record.tick, 4);
+            p = put_hex(p, record.size, 8);
+            p = put_hex(p, record.addr, 8);
+            *p++ = '\n';
+            *p++ = '\r';
+            *p = '\0';
+            UART_put(line);
+        }
+        OSTimeDly(1);
+    }
+}
+
+#endif
@@ -0,0 +1,886 @@
+/*
+ * ----------------------------------------------------------------------------
+ * "THE BEER-WARE LICENSE" (Revision 42):
+ * <...> wrote this file.  As long as you retain this notice you
+ * can do whatever you want with this stuff. If we meet some day, and you think
+ * this stuff is worth it, you can buy me a beer in return.   Robin Massink
+ * ----------------------------------------------------------------------------
+ *
+ * processor   : x86 (host build)
+ *
+ * File        : bench.c
+ * Version     : 1.0
+ *
+ * Toolchain   : GCC
+ * Description : micro-benchmarks for malloc.c
+ *
+ * Runs a few allocation patterns on the host build of malloc.c, and reports
+ * for malloc and free the number of calls, calls per second and the average
+ * and worst time per call. Every benchmark starts on an empty heap.
+ *
+ * Only the time spent inside malloc/free is counted. The numbers are for the
+ * host, so use them to compare versions and settings of malloc.c, not as the
+ * speed on the board.
+ *
+ * comb and quick-flood are the worst cases of the first-fit engine: a long
+ * free list of holes that are all too small, and full quick lists. Built with
+ * MALLOC_BOUNDED, every benchmark checks that no search looked at more free
+ * blocks than the bound, and that no malloc went through more than three
+ * times that (a search, a flush of the quick lists, and a search again). The
+ * exit status is 1 if one did. Built with WCET_SITES, the worst cycles of
+ * each call site follow the benchmark. comb and quick-flood then run
+ * WCET_RUNS times, and a site keeps the lowest of its worst times: the runs
+ * are the same, so a slow path shows in every one, a call the host preempted
+ * in only one. With MALLOC_BOUNDED too, the exit status is 1 if a site of
+ * those two took more than WCET_BUDGET cycles.
+ *
+ * stack-pool fills every stack of a stack pool to its last byte, and checks
+ * that the heap walk still finds the block after the pool. calloc-clean
+ * writes under the stack pointer after init_malloc, as main does, and checks
+ * that calloc still returns zeros. Built with
+ * MALLOC_OWNER and MALLOC_ISR, isr-owner frees blocks of a task from an
+ * interrupt, and checks that free_all_for_task does not free them a second
+ * time. isr-race does the same with an interrupt that comes while
+ * free_all_for_task runs. The exit status is 1 as well if a check fails.
+ *
+ * (stdlib.h is not included, it would declare the renamed malloc as well)
+ */
+
+#include <stdio.h>
+#include <time.h>
+
+#include "host.h"
+
+
+/*
+ * Tweakable parameters
+ */
+
+#define SLOTS             128//blocks kept at the same time
+#define CHURN_OPS         200000//malloc/free pairs of the churn benchmarks
+#define ROUNDS            2000//rounds of the order benchmarks
+#define POOL_STACKS       8//stacks in the stack-pool benchmark
+#define POOL_STACK_SIZE   200//bytes asked for per stack
+#define OWNER_BLOCKS      16//blocks the task of isr-owner frees from an interrupt
+#define OWNER_PRIO        10//priority of that task
+#define CALLER_STACK      512//bytes the caller of init_malloc writes under its stack pointer
+#define CLEAN_BLOCK       256//bytes asked per calloc in calloc-clean
+#ifndef WCET_BUDGET
+#define WCET_BUDGET       10000//cycles a call of comb or quick-flood may take
+#endif
+#define WCET_RUNS         5//runs of comb and quick-flood, see report_sites
+
+#if defined(MALLOC_BOUNDED) && MALLOC_BOUNDED
+// most blocks one malloc may go through: a search, a flush of the quick
+// lists, and a search again, see MALLOC_BOUNDED in malloc.c
+#define CALL_BOUND        (3 * MALLOC_BOUNDED)
+#endif
+
+
+/*
+ * Local types and variabeles
+ */
+
+// time spent in one kind of call
+typedef struct op_stats {
+    unsigned long       calls;
+    unsigned long       failed;//malloc returned NULL
+    unsigned long       gave_up;//of those, MALLOC_TIME_BOUND
+    double              total_ns;
+    double              max_ns;
+} op_stats;
+
+static op_stats malloc_times;
+static op_stats free_times;
+
+static void *slots[SLOTS];
+static unsigned int random_state;
+static double timer_ns;//time now_ns() itself takes, taken off every call
+static int bound_broken;//a search or malloc went through more blocks than allowed
+static int budget_broken;//a call of comb or quick-flood took more than WCET_BUDGET
+static int heap_broken;//a check of stack-pool or isr-owner failed
+#if defined(MALLOC_OWNER) && MALLOC_OWNER && defined(MALLOC_ISR) && MALLOC_ISR
+static void *race_blocks[OWNER_BLOCKS];//of the task, see isr_race
+static int race_next;//the one race_interrupt frees next
+static int race_freed;//how many it freed
+#endif
+#if defined(WCET_SITES) && WCET_SITES
+static wcet_site sites[WCET_SITES];//worst cycles of each call site, see keep_sites
+static unsigned int site_count;
+#endif
+
+
+/*
+ * Local function prototypes
+ */
+
+static double now_ns(void);
+static void calibrate_timer(void);
+static unsigned int random_next(void);
+static unsigned int random_size(void);
+static void *timed_malloc(unsigned int size);
+static void timed_free(void *mem);
+static void free_all(void);
+static void report(const char *name, const char *op, op_stats *stats);
+static void report_bound(void);
+static void keep_sites(int first);
+static void report_sites(unsigned int budget);
+static void run(const char *name, void (*bench)(void), unsigned int budget);
+
+static void fixed_churn(void);
+static void mixed_churn(void);
+static void lifo_order(void);
+static void fifo_order(void);
+static void grow_shrink(void);
+static void comb(void);
+static void quick_flood(void);
+static void stack_pool_fill(void);
+static void calloc_clean(void);
+#if defined(MALLOC_OWNER) && MALLOC_OWNER && defined(MALLOC_ISR) && MALLOC_ISR
+static void isr_owner(void);
+static void isr_race(void);
+static void race_interrupt(void);
+#endif
+
+
+/*
+ * Function implementations
+ */
+
+int main(void)
+{
+    printf("malloc.c host benchmark, %d bytes of heap, engine: %s\n", HOST_RAM,
+#if defined(MALLOC_TLSF) && MALLOC_TLSF
+           "TLSF"
+#elif defined(MALLOC_FIT) && (MALLOC_FIT == FIT_NEXT)
+           "first-fit list, next fit"
+#elif defined(MALLOC_FIT) && (MALLOC_FIT == FIT_BEST)
+           "first-fit list, best fit"
+#else
+           "first-fit"
+#endif
+           );
+#if defined(MALLOC_BOUNDED) && MALLOC_BOUNDED
+    printf("searches bounded to %d free blocks\n", MALLOC_BOUNDED);
+#endif
+    calibrate_timer();
+    printf("timer overhead %.1f ns, taken off every call\n", timer_ns);
+    printf("%-14s %-7s %10s %10s %12s %10s %10s\n",
+           "benchmark", "call", "calls", "failed", "calls/s", "avg ns", "max ns");
+    
+    run("fixed-churn", fixed_churn, 0);
+    run("mixed-churn", mixed_churn, 0);
+    run("lifo-order", lifo_order, 0);
+    run("fifo-order", fifo_order, 0);
+    run("grow-shrink", grow_shrink, 0);
+    run("comb", comb, WCET_BUDGET);
+    run("quick-flood", quick_flood, WCET_BUDGET);
+    run("stack-pool", stack_pool_fill, 0);
+    run("calloc-clean", calloc_clean, 0);
+#if defined(MALLOC_OWNER) && MALLOC_OWNER && defined(MALLOC_ISR) && MALLOC_ISR
+    run("isr-owner", isr_owner, 0);
+    run("isr-race", isr_race, 0);
+#endif
+    return bound_broken || budget_broken || heap_broken;
+}
+
+
+/*
+ * Benchmarks
+ */
+
+/* fixed_churn
+ *
+ * frees and allocates random blocks of 32 bytes.
+ */
+
+static void fixed_churn(void)
+{
+    unsigned long i;
+    unsigned int slot;
+    
+    for(slot = 0; slot < SLOTS; slot++)
+        slots[slot] = timed_malloc(32);
+    for(i = 0; i < CHURN_OPS; i++)
+    {
+        slot = random_next() % SLOTS;
+        timed_free(slots[slot]);
+        slots[slot] = timed_malloc(32);
+    }
+}
+
+
+/* mixed_churn
+ *
+ * frees random blocks, and allocates blocks of random size in their place.
+ */
+
+static void mixed_churn(void)
+{
+    unsigned long i;
+    unsigned int slot;
+    
+    for(slot = 0; slot < SLOTS; slot++)
+        slots[slot] = timed_malloc(random_size());
+    for(i = 0; i < CHURN_OPS; i++)
+    {
+        slot = random_next() % SLOTS;
+        timed_free(slots[slot]);
+        slots[slot] = timed_malloc(random_size());
+    }
+}
+
+
+/* lifo_order
+ *
+ * allocates blocks of random size, and frees them last one first.
+ */
+
+static void lifo_order(void)
+{
+    unsigned int round;
+    int slot;
+    
+    for(round = 0; round < ROUNDS; round++)
+    {
+        for(slot = 0; slot < SLOTS; slot++)
+            slots[slot] = timed_malloc(random_size());
+        for(slot = SLOTS - 1; slot >= 0; slot--)
+        {
+            timed_free(slots[slot]);
+            slots[slot] = NULL;
+        }
+    }
+}
+
+
+/* fifo_order
+ *
+ * allocates blocks of random size, and frees them first one first.
+ */
+
+static void fifo_order(void)
+{
+    unsigned int round;
+    int slot;
+    
+    for(round = 0; round < ROUNDS; round++)
+    {
+        for(slot = 0; slot < SLOTS; slot++)
+            slots[slot] = timed_malloc(random_size());
+        for(slot = 0; slot < SLOTS; slot++)
+        {
+            timed_free(slots[slot]);
+            slots[slot] = NULL;
+        }
+    }
+}
+
+
+/* grow_shrink
+ *
+ * grows the heap block by block until it is full, and shrinks it again by
+ * freeing the last block first, so every call works at heap_end.
+ */
+
+static void grow_shrink(void)
+{
+    static void *blocks[HOST_RAM / 64];
+    unsigned int round;
+    int count;
+    
+    for(round = 0; round < ROUNDS / 10; round++)
+    {
+        for(count = 0; count < (int)(sizeof(blocks) / sizeof(blocks[0])); count++)
+        {
+            blocks[count] = timed_malloc(48 + random_next() % 64);
+            if(blocks[count] == NULL)//heap is full
+                break;
+        }
+        while(--count >= 0)
+            timed_free(blocks[count]);
+    }
+}
+
+
+/* comb
+ *
+ * fills the heap with blocks of 48 bytes, frees every other one, and asks for
+ * blocks of 200 bytes, which fit none of the holes. An unbounded search looks
+ * at every hole before it fails.
+ */
+
+static void comb(void)
+{
+    static void *blocks[HOST_RAM / 48];
+    int count;
+    int i;
+    
+    for(count = 0; count < (int)(sizeof(blocks) / sizeof(blocks[0])); count++)
+    {
+        blocks[count] = timed_malloc(48);
+        if(blocks[count] == NULL)//heap is full
+            break;
+    }
+    for(i = 0; i < count; i += 2)
+        timed_free(blocks[i]);
+    for(i = 0; i < ROUNDS; i++)
+        timed_free(timed_malloc(200));
+    for(i = 1; i < count; i += 2)
+        timed_free(blocks[i]);
+}
+
+
+/* quick_flood
+ *
+ * fills the heap with blocks of 16 bytes, and frees all but the last, so they
+ * wait unmerged on the quick lists. Then asks for a large block until it gets
+ * one, which takes a flush of the quick lists, in one call or, with
+ * MALLOC_BOUNDED, spread over a few.
+ */
+
+static void quick_flood(void)
+{
+    static void *blocks[HOST_RAM / 16];
+    unsigned int round;
+    int count;
+    int i;
+    void *mem;
+    
+    for(round = 0; round < ROUNDS / 100; round++)
+    {
+        for(count = 0; count < (int)(sizeof(blocks) / sizeof(blocks[0])); count++)
+        {
+            blocks[count] = timed_malloc(16);
+            if(blocks[count] == NULL)
+                break;
+        }
+        if(count == 0)
+            return;
+        for(i = 0; i < count - 1; i++)
+            timed_free(blocks[i]);
+        for(i = 0; i < count; i++)//each call flushes some
+        {
+            mem = timed_malloc(4096);
+            if(mem != NULL)
+                break;
+        }
+        timed_free(mem);
+        timed_free(blocks[count - 1]);
+    }
+}
+
+
+/* stack_pool_fill
+ *
+ * carves a stack pool with a block right after it, and writes every byte of
+ * every stack, as a task that runs its stack full would. Then walks the heap,
+ * which must still find the block after the pool, used and as large as asked
+ * for. A stack that runs past the end of the pool block would overwrite its
+ * header.
+ */
+
+static void stack_pool_fill(void)
+{
+    stack_pool pool;
+    heap_walker walker;
+    heap_block block;
+    unsigned char *stacks[POOL_STACKS];
+    unsigned char *after;
+    unsigned int i, j;
+    int found = 0;
+    
+    if(init_stack_pool(&pool, POOL_STACK_SIZE, POOL_STACKS) != POOL_STACKS)
+        return;
+    after = timed_malloc(24);
+    if(after == NULL)
+        return;
+    for(i = 0; i < POOL_STACKS; i++)
+    {
+        stacks[i] = get_stack(&pool);
+        for(j = 0; j < pool.size; j++)
+            stacks[i][j] = 0xa5;
+    }
+    for(i = 0; i < POOL_STACKS; i++)
+        put_stack(&pool, stacks[i]);
+    
+    heap_walk_start(&walker);
+    while(heap_walk(&walker, &block))
+    {
+        if((block.mem == after) && !block.free && (block.size >= 24))
+            found = 1;
+    }
+    printf("%-14s stacks of %u bytes in %u-%u, block after it %s\n", "", pool.size,
+           (unsigned int)(pool.start - host_ram), (unsigned int)(pool.end - host_ram),
+           found ? "intact" : "OVERWRITTEN");
+    if(!found)
+        heap_broken = 1;
+    else
+        timed_free(after);
+}
+
+
+/* calloc_clean
+ *
+ * writes the CALLER_STACK bytes under the stack pointer, as the calls of main
+ * after init_malloc do on the board, then callocs blocks until the heap is
+ * full. Every byte must be zero, also of the blocks the heap grew into.
+ */
+
+static void calloc_clean(void)
+{
+    static unsigned char *blocks[HOST_RAM / CLEAN_BLOCK];
+    unsigned int count;
+    unsigned int dirty = 0;
+    unsigned int i, j;
+    
+    for(i = 1; i <= CALLER_STACK; i++)
+        host_stack_ptr[-(int)i] = 0xa5;
+    for(count = 0; count < sizeof(blocks) / sizeof(blocks[0]); count++)
+    {
+        blocks[count] = calloc(1, CLEAN_BLOCK);
+        if(blocks[count] == NULL)//heap is full
+            break;
+        for(j = 0; j < CLEAN_BLOCK; j++)
+        {
+            if(blocks[count][j] != 0)
+                dirty++;
+        }
+    }
+    printf("%-14s %u blocks of %u bytes, %u %s\n", "", count, CLEAN_BLOCK, dirty,
+           dirty ? "BYTES NOT ZERO" : "bytes not zero");
+    if(dirty != 0)
+        heap_broken = 1;
+    for(i = 0; i < count; i++)
+        free(blocks[i]);
+}
+
+
+#if defined(MALLOC_OWNER) && MALLOC_OWNER && defined(MALLOC_ISR) && MALLOC_ISR
+/* isr_owner
+ *
+ * a task allocates blocks of the size of the pool of malloc_from_isr, and an
+ * interrupt frees them. Then free_all_for_task cleans up after the task. A
+ * block that is freed twice ends up both in the pool and in the heap, so it
+ * is handed out by malloc and by malloc_from_isr at the same time.
+ */
+
+static void isr_owner(void)
+{
+    static void *blocks[OWNER_BLOCKS];
+    static void *pool[2 * OWNER_BLOCKS];
+    heap_walker walker;
+    heap_block block;
+    unsigned int size = 0;
+    int freed;
+    int shared = 0;
+    int count;
+    int i, j;
+    
+    OSRunning = 1;
+    OSPrioCur = OWNER_PRIO;
+    pool[0] = malloc_from_isr(1);
+    if(pool[0] == NULL)//no pool
+    {
+        OSRunning = 0;
+        return;
+    }
+    heap_walk_start(&walker);//the size of a pool block
+    while(heap_walk(&walker, &block))
+    {
+        if(block.mem == pool[0])
+            size = block.size;
+    }
+    free_from_isr(pool[0]);
+    
+    for(i = 0; i < OWNER_BLOCKS; i++)
+        blocks[i] = timed_malloc(size);
+    for(i = 0; i < OWNER_BLOCKS; i++)
+        free_from_isr(blocks[i]);
+    freed = free_all_for_task(OWNER_PRIO);
+    
+    for(i = 0; i < OWNER_BLOCKS; i++)
+        blocks[i] = timed_malloc(size);
+    for(count = 0; count < 2 * OWNER_BLOCKS; count++)
+    {
+        pool[count] = malloc_from_isr(1);
+        if(pool[count] == NULL)
+            break;
+    }
+    for(i = 0; i < OWNER_BLOCKS; i++)
+    {
+        for(j = 0; j < count; j++)
+        {
+            if((blocks[i] != NULL) && (blocks[i] == pool[j]))
+                shared++;
+        }
+    }
+    printf("%-14s free_all_for_task freed %d blocks again, %d %s\n", "", freed,
+           shared, shared ? "BLOCKS IN POOL AND HEAP" : "blocks in pool and heap");
+    if((freed != 0) || (shared != 0))
+        heap_broken = 1;
+    else
+    {
+        for(i = 0; i < OWNER_BLOCKS; i++)
+            timed_free(blocks[i]);
+        for(j = 0; j < count; j++)
+            free_from_isr(pool[j]);
+        flush_isr_frees();
+    }
+    OSRunning = 0;
+}
+
+
+/* isr_race
+ *
+ * a task allocates blocks, and free_all_for_task cleans up after it while an
+ * interrupt frees every other block, one each time the heap lock is given
+ * back. One of those may be the block free_all_for_task is freeing. A block
+ * freed twice is handed out twice by the mallocs after it.
+ */
+
+static void isr_race(void)
+{
+    static void *again[2 * OWNER_BLOCKS];
+    void *fence;
+    int freed;
+    int shared = 0;
+    int count;
+    int i, j;
+    
+    OSRunning = 1;
+    OSPrioCur = OWNER_PRIO;
+    for(i = 0; i < OWNER_BLOCKS; i++)
+        race_blocks[i] = timed_malloc(40);
+    OSPrioCur = OWNER_PRIO + 1;//of another task, keeps the blocks off the end of the heap
+    fence = timed_malloc(40);
+    OSPrioCur = OWNER_PRIO;
+    race_next = 0;
+    race_freed = 0;
+    host_interrupt = race_interrupt;
+    freed = free_all_for_task(OWNER_PRIO);
+    host_interrupt = NULL;
+    flush_isr_frees();
+    
+    for(count = 0; count < 2 * OWNER_BLOCKS; count++)
+    {
+        again[count] = timed_malloc(40);
+        if(again[count] == NULL)
+            break;
+    }
+    for(i = 0; i < count; i++)
+    {
+        for(j = i + 1; j < count; j++)
+        {
+            if(again[i] == again[j])
+                shared++;
+        }
+    }
+    printf("%-14s free_all_for_task freed %d blocks, the interrupt %d, %d %s\n", "", freed,
+           race_freed, shared, shared ? "BLOCKS HANDED OUT TWICE" : "blocks handed out twice");
+    if(shared != 0)
+        heap_broken = 1;
+    else
+    {
+        for(i = 0; i < count; i++)
+            timed_free(again[i]);
+    }
+    timed_free(fence);
+    OSRunning = 0;
+}
+
+
+/* race_interrupt
+ *
+ * frees the next of every other block of isr_race, as an interrupt.
+ */
+
+static void race_interrupt(void)
+{
+    if(race_next >= OWNER_BLOCKS)
+        return;
+    free_from_isr(race_blocks[race_next]);
+    race_next += 2;
+    race_freed++;
+}
+#endif
+
+
+/*
+ * Local function implementations
+ */
+
+/* now_ns
+ *
+ * returns a monotonic time in nanoseconds.
+ */
+
+static double now_ns(void)
+{
+    struct timespec ts;
+    
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+
+/* calibrate_timer
+ *
+ * measures how long reading the time takes, so it can be taken off again.
+ */
+
+static void calibrate_timer(void)
+{
+    double start;
+    int i;
+    
+    start = now_ns();
+    for(i = 0; i < 100000; i++)
+        now_ns();
+    timer_ns = (now_ns() - start) / 100000;
+}
+
+
+/* random_next
+ *
+ * xorshift random numbers, so every run uses the same sequence.
+ */
+
+static unsigned int random_next(void)
+{
+    random_state ^= random_state << 13;
+    random_state ^= random_state >> 17;
+    random_state ^= random_state << 5;
+    return random_state;
+}
+
+
+/* random_size
+ *
+ * returns a block size, mostly small ones, as on the board.
+ */
+
+static unsigned int random_size(void)
+{
+    if(random_next() % 4)
+        return 1 + random_next() % 64;
+    return 1 + random_next() % 512;
+}
+
+
+/* timed_malloc, timed_free
+ *
+ * calls malloc/free, and adds the time they took to their stats.
+ */
+
+static void *timed_malloc(unsigned int size)
+{
+    double start, ns;
+    void *mem;
+    
+    start = now_ns();
+    mem = malloc(size);
+    ns = now_ns() - start - timer_ns;
+    if(ns < 0)
+        ns = 0;
+    
+    malloc_times.calls++;
+    malloc_times.total_ns += ns;
+    if(ns > malloc_times.max_ns)
+        malloc_times.max_ns = ns;
+    if(mem == NULL)
+        malloc_times.failed++;
+#if defined(MALLOC_BOUNDED) && MALLOC_BOUNDED
+    if((mem == NULL) && (malloc_error() == MALLOC_TIME_BOUND))
+        malloc_times.gave_up++;
+#endif
+    return mem;
+}
+
+static void timed_free(void *mem)
+{
+    double start, ns;
+    
+    if(mem == NULL)//failed malloc, nothing to time
+        return;
+    start = now_ns();
+    free(mem);
+    ns = now_ns() - start - timer_ns;
+    if(ns < 0)
+        ns = 0;
+    
+    free_times.calls++;
+    free_times.total_ns += ns;
+    if(ns > free_times.max_ns)
+        free_times.max_ns = ns;
+}
+
+
+/* free_all
+ *
+ * frees what a benchmark left in the slots, without timing it.
+ */
+
+static void free_all(void)
+{
+    unsigned int slot;
+    
+    for(slot = 0; slot < SLOTS; slot++)
+    {
+        free(slots[slot]);
+        slots[slot] = NULL;
+    }
+}
+
+
+/* report
+ *
+ * prints one line of results.
+ */
+
+static void report(const char *name, const char *op, op_stats *stats)
+{
+    double avg = stats->calls ? stats->total_ns / stats->calls : 0;
+    double rate = stats->total_ns > 0 ? stats->calls * 1e9 / stats->total_ns : 0;
+    
+    printf("%-14s %-7s %10lu %10lu %12.0f %10.1f %10.0f\n",
+           name, op, stats->calls, stats->failed, rate, avg, stats->max_ns);
+}
+
+
+/* report_bound
+ *
+ * checks that no search of the benchmark looked at more free blocks than
+ * MALLOC_BOUNDED, and no malloc went through more than CALL_BOUND blocks in
+ * all, and prints the worst of both.
+ */
+
+static void report_bound(void)
+{
+#if defined(MALLOC_BOUNDED) && MALLOC_BOUNDED
+    fit_stats fits;
+    unsigned int worst = 0;
+    int fit;
+    int broken;
+    
+    malloc_fit_stats(&fits);
+    for(fit = 0; fit < FIT_COUNT; fit++)
+    {
+        if(fits.worst[fit] > worst)
+            worst = fits.worst[fit];
+    }
+    broken = (worst > MALLOC_BOUNDED) || (fits.worst_call > CALL_BOUND);
+    printf("%-14s worst search %u free blocks, worst call %u of %u, %lu calls gave up%s\n", "",
+           worst, fits.worst_call, CALL_BOUND, malloc_times.gave_up, broken ? ", BOUND BROKEN" : "");
+    if(broken)
+        bound_broken = 1;
+#endif
+}
+
+
+/* keep_sites
+ *
+ * gets the worst cycles of each call site from malloc.c after a run. The
+ * first run fills the table, later runs lower the worst of a site if they
+ * did better, see WCET_RUNS.
+ */
+
+static void keep_sites(int first)
+{
+#if defined(WCET_SITES) && WCET_SITES
+    wcet_site now[WCET_SITES];
+    unsigned int count;
+    unsigned int i, j;
+    
+    count = malloc_wcet(now, WCET_SITES);
+    if(first)
+    {
+        for(i = 0; i < count; i++)
+            sites[i] = now[i];
+        site_count = count;
+        return;
+    }
+    for(i = 0; i < site_count; i++)
+    {
+        for(j = 0; j < count; j++)
+        {
+            if((now[j].site == sites[i].site) && (now[j].worst < sites[i].worst))
+                sites[i].worst = now[j].worst;
+        }
+    }
+#else
+    (void)first;
+#endif
+}
+
+
+/* report_sites
+ *
+ * prints the worst cycles of each call site, as kept by keep_sites. With
+ * MALLOC_BOUNDED, a site over 'budget' cycles fails the benchmark, 0 checks
+ * nothing.
+ */
+
+static void report_sites(unsigned int budget)
+{
+#if defined(WCET_SITES) && WCET_SITES
+    static const char *op_names[] = {"", "malloc", "free", "calloc", "realloc", "memalign"};
+    unsigned int i;
+    int over;
+    
+    for(i = 0; i < site_count; i++)
+    {
+        over = 0;
+#if defined(MALLOC_BOUNDED) && MALLOC_BOUNDED
+        over = (budget != 0) && (sites[i].worst > budget);
+#endif
+        printf("%-14s site %p %-8s %10u calls, worst %u cycles%s\n", "", sites[i].site,
+               sites[i].op <= TRACE_MEMALIGN ? op_names[sites[i].op] : "?", sites[i].calls,
+               sites[i].worst, over ? ", OVER BUDGET" : "");
+        if(over)
+            budget_broken = 1;
+    }
+#else
+    (void)budget;
+#endif
+}
+
+
+/* run
+ *
+ * runs a benchmark on an empty heap, and reports it. With a 'budget' and
+ * WCET_SITES, it runs WCET_RUNS times, the calls and the bound are those of
+ * the last run.
+ */
+
+static void run(const char *name, void (*bench)(void), unsigned int budget)
+{
+    static const op_stats empty;
+    int runs = 1;
+    int i;
+    
+#if defined(WCET_SITES) && WCET_SITES
+    if(budget != 0)
+        runs = WCET_RUNS;
+#endif
+    for(i = 0; i < runs; i++)
+    {
+        malloc_times = empty;
+        free_times = empty;
+        random_state = 2463534242U;
+        if(host_init() != 0)
+        {
+            printf("%-14s init_malloc failed\n", name);
+            return;
+        }
+        
+        bench();
+        free_all();
+        keep_sites(i == 0);
+    }
+    
+    report(name, "malloc", &malloc_times);
+    report(name, "free", &free_times);
+    report_bound();
+    report_sites(budget);
+}
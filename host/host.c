@@ -0,0 +1,102 @@
+/*
+ * ----------------------------------------------------------------------------
+ * "THE BEER-WARE LICENSE" (Revision 42):
+ * <...> wrote this file.  As long as you retain this notice you
+ * can do whatever you want with this stuff. If we meet some day, and you think
+ * this stuff is worth it, you can buy me a beer in return.   Robin Massink
+ * ----------------------------------------------------------------------------
+ *
+ * processor   : x86 (host build)
+ *
+ * File        : host.c
+ * Version     : 1.0
+ *
+ * Toolchain   : GCC
+ * Description : host build support for malloc.c, see host.h
+ */
+
+#include <time.h>
+
+#include "host.h"
+
+
+/*
+ * Global variabeles
+ */
+
+// the arena takes the place of the linker 'end' symbol(the end of .bss)
+unsigned char   host_ram[HOST_RAM] asm ("end") __attribute__ ((aligned (16)));
+unsigned char * host_stack_ptr = host_ram + HOST_RAM;
+
+#if defined(MALLOC_UCOS) && MALLOC_UCOS
+// the kernel state malloc.c looks at, see includes.h
+BOOLEAN         OSRunning;
+INT8U           OSPrioCur;
+INT8U           OSLockNesting;
+void         (* host_interrupt)(void);
+#endif
+
+
+/*
+ * Function implementations
+ */
+
+/* host_init
+ *
+ * call to (re)start the heap on an empty arena, with the stack at the top of
+ * it. Returns what init_malloc returns.
+ */
+
+int host_init(void)
+{
+    host_stack_ptr = host_ram + HOST_RAM;
+    return init_malloc();
+}
+
+
+/* host_cycles
+ *
+ * returns the cycle counter of the cpu, for WCET_CLOCK() in malloc.c. Only
+ * differences are used, so it may wrap around.
+ */
+
+unsigned int host_cycles(void)
+{
+#if defined(__i386__) || defined(__x86_64__)
+    return (unsigned int)__builtin_ia32_rdtsc();
+#else
+    struct timespec ts;
+    
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (unsigned int)(ts.tv_sec * 1000000000UL + ts.tv_nsec);
+#endif
+}
+
+
+#if defined(MALLOC_UCOS) && MALLOC_UCOS
+/* OSSchedLock, OSSchedUnlock, OSTimeGet
+ *
+ * the kernel calls of malloc.c. There is only one task, so the lock only
+ * counts, to see it is taken and given back in pairs. When the last lock is
+ * given back, host_interrupt is called, if set, as an interrupt that came in
+ * while the heap was locked.
+ */
+
+void OSSchedLock(void)
+{
+    OSLockNesting++;
+}
+
+void OSSchedUnlock(void)
+{
+    if(OSLockNesting > 0)
+        OSLockNesting--;
+    if((OSLockNesting == 0) && (host_interrupt != NULL))
+        host_interrupt();
+}
+
+INT32U OSTimeGet(void)
+{
+    return host_cycles();
+}
+#endif
@@ -0,0 +1,75 @@
+/*
+ * ----------------------------------------------------------------------------
+ * "THE BEER-WARE LICENSE" (Revision 42):
+ * <...> wrote this file.  As long as you retain this notice you
+ * can do whatever you want with this stuff. If we meet some day, and you think
+ * this stuff is worth it, you can buy me a beer in return.   Robin Massink
+ * ----------------------------------------------------------------------------
+ *
+ * processor   : x86 (host build)
+ *
+ * File        : host.h
+ * Version     : 1.0
+ *
+ * Toolchain   : GCC
+ * Description : host build support for malloc.c
+ *
+ * Stands in for the board: the linker 'end' symbol becomes a static arena of
+ * HOST_RAM bytes, and the stack pointer is simulated by host_stack_ptr, which
+ * starts at the top of the arena. malloc.c must be compiled with MALLOC_HOST.
+ * With MALLOC_UCOS, includes.h stands in for uC/OS-II.
+ */
+
+
+#ifndef   HOST_H
+#define   HOST_H
+
+#if defined(MALLOC_UCOS) && MALLOC_UCOS
+#include "includes.h"
+#endif
+#include "malloc.h"
+
+/*
+ * Global defines
+ */
+
+/* HOST_RAM
+ *
+ * size of the arena in bytes, the free RAM of the LPC2106 by default.
+ */
+#ifndef HOST_RAM
+#define HOST_RAM        65536
+#endif
+
+
+/*
+ * Global variabeles
+ */
+
+extern unsigned char   host_ram[HOST_RAM] asm ("end");//the arena, called 'end' for malloc.c
+extern unsigned char * host_stack_ptr;//the simulated stack pointer
+#if defined(MALLOC_UCOS) && MALLOC_UCOS
+extern void         (* host_interrupt)(void);//called when the heap lock is given back
+#endif
+
+
+/*
+ * Global functions
+ */
+
+/* host_init
+ *
+ * call to (re)start the heap on an empty arena, with the stack at the top of
+ * it. Returns what init_malloc returns.
+ */
+int      host_init(void);
+
+
+/* host_cycles
+ *
+ * returns the cycle counter of the cpu(the time stamp counter on x86, else
+ * nanoseconds), malloc.c times its calls with it for WCET_SITES.
+ */
+unsigned int host_cycles(void);
+
+#endif    /*HOST_H*/
@@ -0,0 +1,60 @@
+/*
+ * ----------------------------------------------------------------------------
+ * "THE BEER-WARE LICENSE" (Revision 42):
+ * <...> wrote this file.  As long as you retain this notice you
+ * can do whatever you want with this stuff. If we meet some day, and you think
+ * this stuff is worth it, you can buy me a beer in return.   Robin Massink
+ * ----------------------------------------------------------------------------
+ *
+ * processor   : x86 (host build)
+ *
+ * File        : includes.h
+ * Version     : 1.0
+ *
+ * Toolchain   : GCC
+ * Description : the parts of uC/OS-II that malloc.c uses, for the host build
+ *
+ * Lets malloc.c be built with MALLOC_UCOS on the host. There are no tasks:
+ * OSRunning and OSPrioCur are set by hand to play one, the scheduler lock
+ * only counts, and the interrupts are never masked, as there are none.
+ */
+
+
+#ifndef   INCLUDES_H
+#define   INCLUDES_H
+
+/*
+ * Global defines
+ */
+
+typedef unsigned char   BOOLEAN;
+typedef unsigned char   INT8U;
+typedef unsigned int    INT32U;
+typedef unsigned int    OS_CPU_SR;
+
+#define OS_LOWEST_PRIO          63
+#define OS_PRIO_SELF            0xFF
+
+#define OS_CRITICAL_METHOD      3
+#define OS_ENTER_CRITICAL()     (cpu_sr = 1)
+#define OS_EXIT_CRITICAL()      ((void)cpu_sr)
+
+
+/*
+ * Global variabeles
+ */
+
+extern BOOLEAN  OSRunning;
+extern INT8U    OSPrioCur;
+extern INT8U    OSLockNesting;
+
+
+/*
+ * Global function prototypes
+ */
+
+void     OSSchedLock(void);
+void     OSSchedUnlock(void);
+INT32U   OSTimeGet(void);
+
+#endif    /*INCLUDES_H*/
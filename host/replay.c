@@ -0,0 +1,431 @@
+/*
+ * ----------------------------------------------------------------------------
+ * "THE BEER-WARE LICENSE" (Revision 42):
+ * <...> wrote this file.  As long as you retain this notice you
+ * can do whatever you want with this stuff. If we meet some day, and you think
+ * this stuff is worth it, you can buy me a beer in return.   Robin Massink
+ * ----------------------------------------------------------------------------
+ *
+ * processor   : x86 (host build)
+ *
+ * File        : replay.c
+ * Version     : 1.0
+ *
+ * Toolchain   : GCC
+ * Description : replays an allocation trace of the board on malloc.c
+ *
+ * Reads the "T:" lines that applic/trace.c sends over the uart (from a file,
+ * or from stdin), and makes the same calls on the host build of malloc.c.
+ * Other lines in the log are skipped. Reports per call the number of calls,
+ * failures and the average and worst time, and for the heap its peak size,
+ * the peak of the bytes in use, and the fragmentation when the heap was at
+ * its peak: the part of it that was not in use.
+ *
+ * Blocks are known by their address on the board, so a free of a block that
+ * was allocated before the trace started, or whose record was lost, is
+ * skipped and counted as unknown.
+ *
+ * -f replays it with another fit policy, see malloc_set_policy. The report
+ * then shows how many free blocks the searches looked at, so the policies
+ * can be compared on the trace of a product.
+ *
+ *   malloc_replay [-f first|next|best] [trace.log]
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#include "host.h"
+
+
+/*
+ * Tweakable parameters
+ */
+
+#define MAP_SLOTS         65536//blocks are looked up by board address / 4
+
+
+/*
+ * Local types and variabeles
+ */
+
+// time spent in one kind of call
+typedef struct op_stats {
+    unsigned long       calls;
+    unsigned long       failed;//returned NULL on the host
+    double              total_ns;
+    double              max_ns;
+} op_stats;
+
+// a block of the board, and where it lives on the host
+typedef struct map_entry {
+    void               *mem;
+    unsigned int        size;//bytes asked
+} map_entry;
+
+static const char *op_names[TRACE_LOST + 1] = {
+    "?", "malloc", "free", "calloc", "realloc", "memalign", "arg", "lost"
+};
+
+static const char *fit_names[FIT_COUNT] = {
+    "first", "next", "best"
+};
+
+static op_stats stats[TRACE_LOST + 1];
+static map_entry map[MAP_SLOTS];
+static trace_record args[256];//last TRACE_ARG record per task, op 0 if none
+
+static unsigned long records;
+static unsigned long unknown;//blocks not found in the map
+static unsigned long lost;//records the board could not send
+static unsigned long live;//bytes in use
+static unsigned long peak_live;
+static unsigned long peak_heap;
+static unsigned long live_at_peak_heap;
+static double timer_ns;//time now_ns() itself takes, taken off every call
+static double start_ns;//of the call being timed
+
+
+/*
+ * Local function prototypes
+ */
+
+static double now_ns(void);
+static void calibrate_timer(void);
+static map_entry *lookup(unsigned int addr);
+static void forget(unsigned int addr);
+static void remember(unsigned int addr, void *mem, unsigned int size);
+static void timed_start(void);
+static void timed_end(unsigned char op, void *mem);
+static int parse_fit(const char *name);
+static void replay(trace_record *record);
+static void report(void);
+
+
+/*
+ * Function implementations
+ */
+
+int main(int argc, char *argv[])
+{
+    FILE *in = stdin;
+    char line[128];
+    const char *p;
+    unsigned int op, prio, tick, size, addr;
+    trace_record record;
+    int fit = -1;
+    int arg = 1;
+    
+    if(argc > 2 && strcmp(argv[1], "-f") == 0)
+    {
+        fit = parse_fit(argv[2]);
+        if(fit < 0)
+        {
+            printf("unknown fit policy %s, use first, next or best\n", argv[2]);
+            return 1;
+        }
+        arg = 3;
+    }
+    if(argc > arg && (in = fopen(argv[arg], "r")) == NULL)
+    {
+        perror(argv[arg]);
+        return 1;
+    }
+    if(host_init() != 0)
+    {
+        printf("init_malloc failed\n");
+        return 1;
+    }
+    if(fit >= 0 && malloc_set_policy(fit) < 0)
+    {
+        printf("this engine has no fit policies\n");
+        return 1;
+    }
+    calibrate_timer();
+    
+    while(fgets(line, sizeof(line), in) != NULL)
+    {
+        p = line;
+        while(*p == '\r' || *p == ' ')//the uart sends "\n\r"
+            p++;
+        if(sscanf(p, "T:%2x%2x%4x%8x%8x", &op, &prio, &tick, &size, &addr) != 5)
+            continue;
+        if(op < TRACE_MALLOC || op > TRACE_LOST)
+            continue;
+        record.op = op;
+        record.prio = prio;
+        record.tick = tick;
+        record.size = size;
+        record.addr = addr;
+        records++;
+        replay(&record);
+    }
+    if(in != stdin)
+        fclose(in);
+    
+    report();
+    return 0;
+}
+
+
+/*
+ * Local function implementations
+ */
+
+/* parse_fit
+ *
+ * returns the FIT_ policy called 'name', or -1 if there is none.
+ */
+
+static int parse_fit(const char *name)
+{
+    int fit;
+    
+    for(fit = 0; fit < FIT_COUNT; fit++)
+    {
+        if(strcmp(name, fit_names[fit]) == 0)
+            return fit;
+    }
+    return -1;
+}
+
+
+/* replay
+ *
+ * makes the call of one record on the host.
+ */
+
+static void replay(trace_record *record)
+{
+    trace_record *arg = &args[record->prio];
+    map_entry *entry;
+    heap_stats usage;
+    void *mem;
+    
+    switch(record->op)
+    {
+    case TRACE_ARG://belongs to the next record of this task
+        *arg = *record;
+        return;
+    
+    case TRACE_LOST:
+        lost += record->size;
+        return;
+    
+    case TRACE_MALLOC:
+        timed_start();
+        mem = malloc(record->size);
+        timed_end(record->op, mem);
+        break;
+    
+    case TRACE_CALLOC:
+        timed_start();
+        mem = calloc(1, record->size);
+        timed_end(record->op, mem);
+        break;
+    
+    case TRACE_MEMALIGN:
+        timed_start();
+        mem = memalign(arg->op ? arg->size : 8, record->size);
+        timed_end(record->op, mem);
+        break;
+    
+    case TRACE_FREE:
+        if(record->addr == 0)//free(NULL)
+            return;
+        entry = lookup(record->addr);
+        if(entry == NULL || entry->mem == NULL)
+        {
+            unknown++;
+            return;
+        }
+        timed_start();
+        free(entry->mem);
+        timed_end(record->op, entry->mem);
+        forget(record->addr);
+        return;
+    
+    case TRACE_REALLOC:
+        entry = NULL;
+        if(arg->op && arg->addr != 0)
+        {
+            entry = lookup(arg->addr);
+            if(entry == NULL || entry->mem == NULL)
+            {
+                unknown++;
+                arg->op = 0;
+                return;
+            }
+        }
+        timed_start();
+        mem = realloc(entry ? entry->mem : NULL, record->size);
+        timed_end(record->op, mem);
+        if(mem == NULL && record->size > 0)//failed, the old block stays
+        {
+            arg->op = 0;
+            return;
+        }
+        if(entry != NULL)
+            forget(arg->addr);
+        break;
+    
+    default:
+        return;
+    }
+    arg->op = 0;
+    
+    if(mem == NULL)
+        return;
+    if(record->addr == 0)//failed on the board, so it is not used
+    {
+        free(mem);
+        return;
+    }
+    remember(record->addr, mem, record->size);
+    if(live > peak_live)
+        peak_live = live;
+    malloc_stats(&usage);
+    if(usage.heap_size > peak_heap)
+    {
+        peak_heap = usage.heap_size;
+        live_at_peak_heap = live;
+    }
+}
+
+
+/* lookup, forget, remember
+ *
+ * find, remove and add the host block of a block of the board.
+ */
+
+static map_entry *lookup(unsigned int addr)
+{
+    if(addr / 4 >= MAP_SLOTS)
+        return NULL;
+    return &map[addr / 4];
+}
+
+static void forget(unsigned int addr)
+{
+    map_entry *entry = lookup(addr);
+    
+    live -= entry->size;
+    entry->mem = NULL;
+    entry->size = 0;
+}
+
+static void remember(unsigned int addr, void *mem, unsigned int size)
+{
+    map_entry *entry = lookup(addr);
+    
+    if(entry == NULL)//beyond the map, give it back right away
+    {
+        unknown++;
+        free(mem);
+        return;
+    }
+    if(entry->mem != NULL)//allocated twice, a free was lost
+        forget(addr);
+    entry->mem = mem;
+    entry->size = size;
+    live += size;
+}
+
+
+/* timed_start, timed_end
+ *
+ * time a call, and add it to the stats of 'op'.
+ */
+
+static void timed_start(void)
+{
+    start_ns = now_ns();
+}
+
+static void timed_end(unsigned char op, void *mem)
+{
+    double ns = now_ns() - start_ns - timer_ns;
+    
+    if(ns < 0)
+        ns = 0;
+    stats[op].calls++;
+    stats[op].total_ns += ns;
+    if(ns > stats[op].max_ns)
+        stats[op].max_ns = ns;
+    if(mem == NULL)
+        stats[op].failed++;
+}
+
+
+/* now_ns
+ *
+ * returns a monotonic time in nanoseconds.
+ */
+
+static double now_ns(void)
+{
+    struct timespec ts;
+    
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+
+/* calibrate_timer
+ *
+ * measures how long reading the time takes, so it can be taken off again.
+ */
+
+static void calibrate_timer(void)
+{
+    double start;
+    int i;
+    
+    start = now_ns();
+    for(i = 0; i < 100000; i++)
+        now_ns();
+    timer_ns = (now_ns() - start) / 100000;
+}
+
+
+/* report
+ *
+ * prints the results.
+ */
+
+static void report(void)
+{
+    unsigned long calls = 0;
+    double total_ns = 0;
+    fit_stats fits;
+    int op;
+    int fit;
+    
+    printf("malloc.c replay, %lu records, %lu lost on the board, %lu unknown blocks\n",
+           records, lost, unknown);
+    printf("%-9s %10s %10s %10s %10s\n", "call", "calls", "failed", "avg ns", "max ns");
+    for(op = TRACE_MALLOC; op <= TRACE_MEMALIGN; op++)
+    {
+        if(stats[op].calls == 0)
+            continue;
+        printf("%-9s %10lu %10lu %10.1f %10.0f\n", op_names[op], stats[op].calls,
+               stats[op].failed, stats[op].total_ns / stats[op].calls, stats[op].max_ns);
+        calls += stats[op].calls;
+        total_ns += stats[op].total_ns;
+    }
+    printf("total %.0f ns, %.1f ns per call\n", total_ns, calls ? total_ns / calls : 0);
+    printf("peak heap %lu bytes, peak in use %lu bytes\n", peak_heap, peak_live);
+    printf("fragmentation at peak heap %.1f%%\n",
+           peak_heap ? 100.0 * (1 - (double)live_at_peak_heap / peak_heap) : 0);
+    
+    malloc_fit_stats(&fits);
+    for(fit = 0; fit < FIT_COUNT; fit++)
+    {
+        if(fits.searches[fit] == 0)
+            continue;
+        printf("%s fit: %u searches, %.1f free blocks visited per search, %u at most\n",
+               fit_names[fit], fits.searches[fit], (double)fits.visits[fit] / fits.searches[fit],
+               fits.worst[fit]);
+    }
+}